@@ -69,6 +69,8 @@ private:
         std::cerr << "  -sweight weight      : Smooth weigth (default: "  << options.smoothWeight << ")\n";
         std::cerr << "  -laplace             : Enable Laplace mesh smoothing (default: " << options.laplace_smoothing << ")\n";
         std::cerr << "  -laplacelayers       : Laplace smooth layers (if laplace enabled default: " << options.laplace_smooth_layers << ")\n";
+        std::cerr << "  -laplaceimplicit true|false : Implicit CG Laplace solve (if laplace enabled default: " << options.laplace_implicit << ")\n";
+        std::cerr << "  -laplacelambda l     : Implicit Laplace step (default: " << options.laplace_lambda << ")\n";
         std::cerr << "  -rwidth              : Ramp width (default: " << options.rampWidth << ")\n";
         std::cerr << "  -rangle              : Ramp angle (default: " << options.rampAngle << ")\n";
         std::cerr << "  -rsep                : Ramp sep (default: " << options.rampSep << ")\n";
@@ -77,6 +79,17 @@ private:
         std::cerr << "  -tile true|false      : Tile texture (repeat) (default: " << options.tile_texture << ")\n";
         std::cerr << "  -occlusion true|false : Enable occlusion gate (default: " << options.occlusion << ")\n";
         std::cerr << "  -oceps eps            : Occlusion epsilon (default: " << options.occlusion_epsilon << ")\n";
+        std::cerr << "  -bilateral true|false : Bilateral depth smoothing (default: " << options.bilateral_depth << ")\n";
+        std::cerr << "  -bsigma spatial range : Bilateral sigmas, pixels and depth (default: "
+            << options.bilateral_sigma_spatial << " " << options.bilateral_sigma_range << ")\n";
+        std::cerr << "  -fillholes true|false : Fill enclosed holes in the depth map (default: " << options.fill_holes << ")\n";
+        std::cerr << "  -fillradius px        : Largest hole radius to fill, 0=any (default: " << options.fill_holes_max_radius << ")\n";
+        std::cerr << "  -meshcache true|false : Reuse/write <model>.memesh next to the model (default: " << options.mesh_cache << ")\n";
+        std::cerr << "  -stream true|false    : Stream binary STL from disk, for meshes larger than memory (default: " << options.stream_mesh << ")\n";
+        std::cerr << "  -stats true|false     : Print per-stage timings and counters (default: " << options.stats << ")\n";
+        std::cerr << "  -statsjson file       : Write stage timings and counters as JSON\n";
+        std::cerr << "  -trace file           : Write a Chrome trace (chrome://tracing, Perfetto)\n";
+        std::cerr << "  -threads n            : Worker threads, 0=all cores (default: " << options.threads << ")\n";
 
     }
 
@@ -167,6 +180,12 @@ public:
             else if (arg == "-laplacelayers" && i + 1 < argc) {
                 options->laplace_smooth_layers = std::atoi(argv[++i]);
             }
+            else if (arg == "-laplaceimplicit" && i + 1 < argc) {
+                options->laplace_implicit = parseBool(argv[++i]);
+            }
+            else if (arg == "-laplacelambda" && i + 1 < argc) {
+                options->laplace_lambda = parseFloat(argv[++i]);
+            }
             else if (arg == "-rwidth" && i + 1 < argc) {
                 options->rampWidth = parseFloat(argv[++i]);
             }
@@ -190,6 +209,37 @@ public:
             }
             else if (arg == "-oceps" && i + 1 < argc) {
                 options->occlusion_epsilon = parseFloat(argv[++i]);
+            }
+            else if (arg == "-bilateral" && i + 1 < argc) {
+                options->bilateral_depth = parseBool(argv[++i]);
+            }
+            else if (arg == "-bsigma" && i + 2 < argc) {
+                options->bilateral_sigma_spatial = parseFloat(argv[++i]);
+                options->bilateral_sigma_range = parseFloat(argv[++i]);
+            }
+            else if (arg == "-fillholes" && i + 1 < argc) {
+                options->fill_holes = parseBool(argv[++i]);
+            }
+            else if (arg == "-fillradius" && i + 1 < argc) {
+                options->fill_holes_max_radius = parseFloat(argv[++i]);
+            }
+            else if (arg == "-meshcache" && i + 1 < argc) {
+                options->mesh_cache = parseBool(argv[++i]);
+            }
+            else if (arg == "-stream" && i + 1 < argc) {
+                options->stream_mesh = parseBool(argv[++i]);
+            }
+            else if (arg == "-stats" && i + 1 < argc) {
+                options->stats = parseBool(argv[++i]);
+            }
+            else if (arg == "-statsjson" && i + 1 < argc) {
+                options->stats_json = argv[++i];
+            }
+            else if (arg == "-trace" && i + 1 < argc) {
+                options->trace_path = argv[++i];
+            }
+            else if (arg == "-threads" && i + 1 < argc) {
+                options->threads = std::atoi(argv[++i]);
             }            else {
                 printhelp();
                 throw std::invalid_argument("Unknown or incomplete option: " + arg);
@@ -10,6 +10,8 @@
 #include "Options.h"
 #include "ParseArgs.h"
 #include "StereogramGenerator.h"
+#include "Stats.h"
+#include "ThreadPool.h"
 
 int main(int argc, char** argv)
 {
@@ -18,8 +20,19 @@ int main(int argc, char** argv)
         if (!ParseArgs::parseArgs(argc, argv, options))
             return 1;
 
+        ThreadPool::instance().setThreadCount(options->threads);
+        Stats::setEnabled(options->stats || !options->stats_json.empty() || !options->trace_path.empty());
+        Stats::instance().reset();
+
         StereogramGenerator st(options);
-        return st.create();
+        int result = st.create();
+
+        if (options->stats) std::cout << Stats::instance().table();
+        if (!options->stats_json.empty() && !Stats::writeFile(options->stats_json, Stats::instance().json()))
+            std::cerr << "Could not write " << options->stats_json << std::endl;
+        if (!options->trace_path.empty() && !Stats::writeFile(options->trace_path, Stats::instance().trace()))
+            std::cerr << "Could not write " << options->trace_path << std::endl;
+        return result;
     }
     catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << std::endl;
@@ -20,6 +20,7 @@
 #include <thread>
 #include <atomic>
 #include <future>
+#include <mutex>
 #include <sstream>
 #include <iostream>
 #include <cmath>
@@ -52,6 +53,8 @@
 #include "Options.h"
 #include "openfile.h"
 #include "StereogramGenerator.h"
+#include "Stats.h"
+#include "ThreadPool.h"
 
 namespace fs = std::filesystem;
 
@@ -68,9 +71,25 @@ static std::atomic<bool> g_is_rendering{ false };
 static std::string g_rendered_image_path;
 static std::string g_rendered_depth_path;
 
+// Progressive preview: newest frame handed from the render thread to the UI thread
+struct PreviewPixels {
+    int w = 0, h = 0;
+    std::vector<uint8_t> sirds;
+    std::vector<uint8_t> depth;
+};
+static std::mutex g_preview_mutex;
+static PreviewPixels g_preview;
+static bool g_preview_pending = false;
+static uint64_t g_preview_generation = 0;  // frames of any other render are dropped
+static StereogramGenerator::CancelToken g_render_cancel;
+static Options g_rendered_options;
+static bool g_rerender_pending = false;
+static std::mutex g_stats_mutex;
+static std::string g_stats_text;            // table from the last render that collected stats
+
 // Forward declarations
 static void glfw_error_callback(int error, const char* description);
-static bool LoadTextureFromFile(const char* filename, GLuint* out_texture, int* out_width, int* out_height);
+static bool LoadTextureFromPixels(const uint8_t* rgb, int w, int h, GLuint* out_texture);
 static fs::path resolve_path(const fs::path& input_path);
 
 // UI helpers
@@ -84,6 +103,11 @@ static ImVec2 FitInto(const ImVec2& avail, int image_w, int image_h);
 static void DrawViewport(bool* open, bool has_result, GLuint tex_sirds, GLuint tex_depth, int img_w, int img_h, int* tab_idx);
 static void DrawInspector(Options* opt, bool& show_stl_openfile, openfile& stl_openfile_dialog, bool& show_texture_openfile, openfile& texture_openfile_dialog);
 static void HandleRenderCompletion(Options* opt);
+static void HandleLivePreview(Options* opt);
+static void StartRender(Options* opt);
+static void UploadPreviewFrame();
+static uint64_t DiscardPreviewFrames();
+static void PublishPreviewFrame(PreviewPixels px, uint64_t generation);
 
 // Small wrapper to use std::string with InputTextWithHint without imgui_stdlib
 static bool InputTextWithHintStr(const char* label, const char* hint, std::string& str, ImGuiInputTextFlags flags = 0)
@@ -284,6 +308,7 @@ int main(int, char**)
         }
 
         // Async render completion
+        HandleLivePreview(options.get());
         HandleRenderCompletion(options.get());
 
         // File dialogs (position near top-left)
@@ -339,12 +364,10 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
 }
 
-// Load image file to OpenGL texture
-static bool LoadTextureFromFile(const char* filename, GLuint* out_texture, int* out_width, int* out_height)
+// Upload a tightly packed RGB buffer to an OpenGL texture
+static bool LoadTextureFromPixels(const uint8_t* rgb, int w, int h, GLuint* out_texture)
 {
-    int w = 0, h = 0;
-    unsigned char* image_data = stbi_load(filename, &w, &h, NULL, 4);
-    if (!image_data) return false;
+    if (!rgb || w <= 0 || h <= 0) return false;
 
     GLuint tex = 0;
     glGenTextures(1, &tex);
@@ -354,12 +377,11 @@ static bool LoadTextureFromFile(const char* filename, GLuint* out_texture, int*
 #ifdef GL_UNPACK_ROW_LENGTH
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 #endif
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
-    stbi_image_free(image_data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
     *out_texture = tex;
-    *out_width = w;
-    *out_height = h;
     return true;
 }
 
@@ -747,11 +769,35 @@ static void DrawInspector(Options* opt, bool& show_stl_openfile, openfile& stl_o
         }
         ImGui::EndDisabled();
 
+        ImGui::Dummy(ImVec2(0, 4));
+        ImGui::Checkbox("Bilateral depth smoothing", &opt->bilateral_depth);
+        ImGui::BeginDisabled(!opt->bilateral_depth);
+        {
+            KnobID("bss", "Spatial", &opt->bilateral_sigma_spatial, 0.5f, 16.0f, 56.0f);
+
+            ImGui::SameLine(0, 24);
+            KnobID("bsr", "Range", &opt->bilateral_sigma_range, 0.005f, 0.5f, 56.0f);
+        }
+        ImGui::EndDisabled();
+
+        ImGui::Dummy(ImVec2(0, 4));
+        ImGui::Checkbox("Fill depth holes", &opt->fill_holes);
+        ImGui::BeginDisabled(!opt->fill_holes);
+        ImGui::SetNextItemWidth(160);
+        CustomWidgets::InputFloat("Max hole radius (0=any)", &opt->fill_holes_max_radius);
+        ImGui::EndDisabled();
+
         ImGui::Dummy(ImVec2(0, 4));
         ImGui::Checkbox("Use Laplace smoothing", &opt->laplace_smoothing);
         ImGui::BeginDisabled(!opt->laplace_smoothing);
+        ImGui::Checkbox("Implicit solve", &opt->laplace_implicit);
         ImGui::SetNextItemWidth(160);
-        CustomWidgets::InputInt("Laplace layers", &opt->laplace_smooth_layers);
+        if (opt->laplace_implicit) {
+            CustomWidgets::InputFloat("Laplace lambda", &opt->laplace_lambda);
+        }
+        else {
+            CustomWidgets::InputInt("Laplace layers", &opt->laplace_smooth_layers);
+        }
         ImGui::EndDisabled();
 
         ImGui::Dummy(ImVec2(0, 4));
@@ -776,37 +822,7 @@ static void DrawInspector(Options* opt, bool& show_stl_openfile, openfile& stl_o
     bool disabled_render = (opt->stlpath.empty() || opt->texpath.empty());
     ImGui::BeginDisabled(disabled_render || g_is_rendering);
     if (ImGui::Button("Render", ImVec2(160, 0))) {
-        g_is_rendering = true;
-        g_has_result = false;
-        if (g_tex_sirds) { glDeleteTextures(1, &g_tex_sirds); g_tex_sirds = 0; }
-        if (g_tex_depth) { glDeleteTextures(1, &g_tex_depth); g_tex_depth = 0; }
-
-        fs::path out = fs::absolute(fs::path(opt->stlpath).replace_extension(""));
-        opt->outprefix = out.string();
-
-        g_render_future = std::async(std::launch::async, [o = std::make_shared<Options>(*opt)]() mutable
-            {
-                try {
-                    StereogramGenerator st(o);
-                    bool ok = !st.create();  // 0 == success
-                    if (ok) {
-                        g_rendered_image_path = o->outprefix + "_sirds.png";
-                        g_rendered_depth_path = o->outprefix + "_depth.png";
-                        return true;
-                    }
-                    return false;
-                }
-                catch (const std::exception& e) {
-                    g_render_error_msg = e.what();
-                    g_render_error_pending = true;
-                    return false;
-                }
-                catch (...) {
-                    g_render_error_msg = "Unknown exception during render.";
-                    g_render_error_pending = true;
-                    return false;
-                }
-            });
+        StartRender(opt);
     }
     ImGui::EndDisabled();
 
@@ -819,36 +835,188 @@ static void DrawInspector(Options* opt, bool& show_stl_openfile, openfile& stl_o
         reset.texpath = tex;
         *opt = reset;
     }
+
+    ImGui::Checkbox("Progressive preview", &opt->progressive_preview);
+    ImGui::SameLine();
+    ImGui::Checkbox("Cache mesh (.memesh)", &opt->mesh_cache);
+    ImGui::SameLine();
+    ImGui::Checkbox("Stream STL", &opt->stream_mesh);
+    ImGui::SameLine();
+    ImGui::Checkbox("Collect stats", &opt->stats);
+    ImGui::SetNextItemWidth(160);
+    ImGui::SliderInt("Threads (0 = all)", &opt->threads, 0, ThreadPool::hardwareThreads());
+
+    if (opt->stats) {
+        std::lock_guard<std::mutex> lock(g_stats_mutex);
+        if (!g_stats_text.empty() && ImGui::CollapsingHeader("Stage timings")) {
+            ImGui::TextUnformatted(g_stats_text.c_str());
+        }
+    }
+}
+
+// Launch an async render of the current options
+static void StartRender(Options* opt)
+{
+    g_is_rendering = true;
+    g_rerender_pending = false;
+    if (!opt->progressive_preview) {
+        // Progressive mode keeps the old image up until the first preview arrives
+        g_has_result = false;
+        if (g_tex_sirds) { glDeleteTextures(1, &g_tex_sirds); g_tex_sirds = 0; }
+        if (g_tex_depth) { glDeleteTextures(1, &g_tex_depth); g_tex_depth = 0; }
+    }
+
+    fs::path out = fs::absolute(fs::path(opt->stlpath).replace_extension(""));
+    opt->outprefix = out.string();
+    g_rendered_options = *opt;
+
+    g_render_cancel = std::make_shared<std::atomic<bool>>(false);
+    const uint64_t generation = DiscardPreviewFrames();
+
+    // The pool and stats are process-wide; renders run one at a time, so this is
+    // never called while one is running
+    ThreadPool::instance().setThreadCount(opt->threads);
+    Stats::setEnabled(opt->stats);
+    Stats::instance().reset();
+
+    g_render_future = std::async(std::launch::async, [o = std::make_shared<Options>(*opt), cancel = g_render_cancel, generation]() mutable
+        {
+            try {
+                StereogramGenerator st(o);
+                StereogramGenerator::RenderResult result;
+                if (o->progressive_preview) {
+                    bool done = st.renderProgressive([generation](const StereogramGenerator::PreviewFrame& frame)
+                        {
+                            PreviewPixels px;
+                            px.w = frame.width;
+                            px.h = frame.height;
+                            px.sirds = frame.sirds_rgb;
+                            px.depth = StereogramGenerator::makeDepthVisualization(frame.depth, frame.width, frame.height);
+                            PublishPreviewFrame(std::move(px), generation);
+                        }, result, cancel);
+                    if (!done) return false;
+                }
+                else {
+                    // Hand the buffers to the UI thread before the PNGs are encoded
+                    result = st.render();
+                    PreviewPixels px;
+                    px.w = result.width;
+                    px.h = result.height;
+                    px.sirds = result.sirds_rgb;
+                    px.depth = result.depth_vis;
+                    PublishPreviewFrame(std::move(px), generation);
+                }
+                bool saved = st.save(result);
+                if (o->stats) {
+                    std::lock_guard<std::mutex> lock(g_stats_mutex);
+                    g_stats_text = Stats::instance().table();
+                }
+                if (saved) {
+                    g_rendered_image_path = o->outprefix + "_sirds.png";
+                    g_rendered_depth_path = o->outprefix + "_depth.png";
+                    return true;
+                }
+                return false;
+            }
+            catch (const std::exception& e) {
+                g_render_error_msg = e.what();
+                g_render_error_pending = true;
+                return false;
+            }
+            catch (...) {
+                g_render_error_msg = "Unknown exception during render.";
+                g_render_error_pending = true;
+                return false;
+            }
+        });
+}
+
+// Drop the frame waiting for upload and start a new generation, so frames a
+// cancelled render publishes while it unwinds are ignored. Returns the new generation.
+static uint64_t DiscardPreviewFrames()
+{
+    std::lock_guard<std::mutex> lock(g_preview_mutex);
+    g_preview = PreviewPixels();
+    g_preview_pending = false;
+    return ++g_preview_generation;
+}
+
+// Render thread: hand a frame to the UI thread unless its render has been superseded
+static void PublishPreviewFrame(PreviewPixels px, uint64_t generation)
+{
+    std::lock_guard<std::mutex> lock(g_preview_mutex);
+    if (generation != g_preview_generation) return;
+    g_preview = std::move(px);
+    g_preview_pending = true;
+}
+
+// Replace the viewport textures with the newest progressive frame, if any
+static void UploadPreviewFrame()
+{
+    PreviewPixels px;
+    {
+        std::lock_guard<std::mutex> lock(g_preview_mutex);
+        if (!g_preview_pending) return;
+        px = std::move(g_preview);
+        g_preview_pending = false;
+    }
+
+    GLuint tex1 = 0, tex2 = 0;
+    bool ok1 = LoadTextureFromPixels(px.sirds.data(), px.w, px.h, &tex1);
+    bool ok2 = LoadTextureFromPixels(px.depth.data(), px.w, px.h, &tex2);
+    if (!ok1 || !ok2) {
+        if (tex1) glDeleteTextures(1, &tex1);
+        if (tex2) glDeleteTextures(1, &tex2);
+        return;
+    }
+
+    if (g_tex_sirds) glDeleteTextures(1, &g_tex_sirds);
+    if (g_tex_depth) glDeleteTextures(1, &g_tex_depth);
+    g_tex_sirds = tex1;
+    g_tex_depth = tex2;
+    g_img_w = px.w;
+    g_img_h = px.h;
+    g_has_result = true;
+}
+
+// Progressive mode: any knob change aborts the stale render and starts a new one
+static void HandleLivePreview(Options* opt)
+{
+    if (!opt->progressive_preview || !g_has_result) return;
+    if (opt->stlpath.empty() || opt->texpath.empty()) return;
+
+    Options current = *opt;
+    current.outprefix = g_rendered_options.outprefix;
+    if (current == g_rendered_options) return;
+
+    if (g_is_rendering) {
+        if (g_render_cancel) g_render_cancel->store(true);
+        DiscardPreviewFrames();
+        g_rendered_options = current;
+        g_rerender_pending = true;  // restart once the stale render has unwound
+        return;
+    }
+    StartRender(opt);
 }
 
 // Render future handling
 static void HandleRenderCompletion(Options* opt)
 {
+    UploadPreviewFrame();
+
     if (!g_is_rendering) return;
     if (!g_render_future.valid()) return;
 
     if (g_render_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
         bool success = g_render_future.get();
+        if (g_rerender_pending) {
+            g_is_rendering = false;
+            StartRender(opt);
+            return;
+        }
         if (success) {
-            GLuint tex1 = 0, tex2 = 0;
-            int w1 = 0, h1 = 0;
-            int w2 = 0, h2 = 0;
-
-            bool ok1 = LoadTextureFromFile(g_rendered_image_path.c_str(), &tex1, &w1, &h1);
-            bool ok2 = LoadTextureFromFile(g_rendered_depth_path.c_str(), &tex2, &w2, &h2);
-
-            if (ok1 && ok2) {
-                g_tex_sirds = tex1;
-                g_tex_depth = tex2;
-                g_img_w = w1;
-                g_img_h = h1;
-                g_has_result = true;
-            }
-            else {
-                if (tex1) glDeleteTextures(1, &tex1);
-                if (tex2) glDeleteTextures(1, &tex2);
-                g_has_result = false;
-            }
+            // The full resolution frame comes from memory, not from the written PNGs
+            UploadPreviewFrame();
         }
         g_is_rendering = false;
     }
@@ -2,57 +2,275 @@
 
 #pragma once
 #include <vector>
+#include <array>
 #include <cstdint>
-#include <random>
+#include <cmath>
 #include <algorithm>
 
+#include "Parallel.h"
+
 class BlueNoise {
 public:
-    // Generate RGB "blue-ish" noise using 8x8 Bayer matrix modulation + hash noise.
-    // Width/height sized to output image for row-coherent, high-frequency pattern.
+    // Powers of two, wrapped with a mask. Rows repeat every kTileWidth pixels, and a
+    // period within the separation range would give the eye a false match (a ghost
+    // plane), so the width exceeds any practical eye separation (default 160).
+    // Vertical repeats cannot be fused, so the height stays small.
+    static constexpr int kTileWidth = 256;
+    static constexpr int kTileHeight = 64;
+    static constexpr int kTileArea = kTileWidth * kTileHeight;
+
+    using Tile = std::array<uint8_t, kTileArea>;
+
+    // Three independent void-and-cluster tiles (one per channel), built once per process.
+    static const std::array<Tile, 3>& tiles()
+    {
+        static const std::array<Tile, 3> t = []()
+            {
+                static constexpr uint32_t salts[3] = { 0x9E3779B9u, 0x85EBCA6Bu, 0xC2B2AE35u };
+                std::array<Tile, 3> out{};
+                Parallel::forRange(0, 3, [&](int c0, int c1)
+                    {
+                        for (int c = c0; c < c1; ++c) out[c] = buildTile(salts[c]);
+                    });
+                return out;
+            }();
+        return t;
+    }
+
+    // Stateless lookup into the tiles; the seed only selects a per-channel offset.
+    // Cheap to copy, safe to share between threads.
+    class Sampler {
+    public:
+        explicit Sampler(uint32_t seed = 1337u) { offsets(seed, ox, oy); }
+
+        std::array<uint8_t, 3> operator()(int x, int y) const
+        {
+            const auto& t = tiles();
+            return { t[0][index(0, x, y)], t[1][index(1, x, y)], t[2][index(2, x, y)] };
+        }
+
+        // Batched lookup of count consecutive pixels starting at (x, y)
+        void colorRun(int x, int y, int count, std::array<uint8_t, 3>* out) const
+        {
+            const auto& t = tiles();
+            const int xmask = kTileWidth - 1;
+            for (int c = 0; c < 3; ++c) {
+                const uint8_t* row = t[c].data() + ((y + oy[c]) & (kTileHeight - 1)) * kTileWidth;
+                const int x0 = x + ox[c];
+                for (int i = 0; i < count; ++i) {
+                    out[i][c] = row[(x0 + i) & xmask];
+                }
+            }
+        }
+
+    private:
+        int ox[3]{};
+        int oy[3]{};
+
+        int index(int c, int x, int y) const
+        {
+            return ((y + oy[c]) & (kTileHeight - 1)) * kTileWidth + ((x + ox[c]) & (kTileWidth - 1));
+        }
+    };
+
+    static std::array<uint8_t, 3> colorAt(uint32_t seed, int x, int y)
+    {
+        return Sampler(seed)(x, y);
+    }
+
+    // Generate a full RGB blue noise image by toroidally wrapping the tiles.
     static std::vector<uint8_t> generateRGB(int width, int height, uint32_t seed = 1337u)
     {
         std::vector<uint8_t> tex(static_cast<size_t>(width) * height * 3);
 
-        static const int bayer8[64] = {
-             0, 32,  8, 40,  2, 34, 10, 42,
-            48, 16, 56, 24, 50, 18, 58, 26,
-            12, 44,  4, 36, 14, 46,  6, 38,
-            60, 28, 52, 20, 62, 30, 54, 22,
-             3, 35, 11, 43,  1, 33,  9, 41,
-            51, 19, 59, 27, 49, 17, 57, 25,
-            15, 47,  7, 39, 13, 45,  5, 37,
-            63, 31, 55, 23, 61, 29, 53, 21
-        };
-
-        auto h32 = [](uint32_t x) {
-            x ^= x >> 17; x *= 0xED5AD4BBu;
-            x ^= x >> 11; x *= 0xAC4C1B51u;
-            x ^= x >> 15; x *= 0x31848BABu;
-            x ^= x >> 14;
-            return x;
-        };
-
+        Sampler noise(seed);
+        std::vector<std::array<uint8_t, 3>> row(static_cast<size_t>(width));
         for (int y = 0; y < height; ++y) {
+            noise.colorRun(0, y, width, row.data());
             for (int x = 0; x < width; ++x) {
-                int b = bayer8[(y & 7) * 8 + (x & 7)];
-                uint32_t base = h32((uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ seed);
-                uint8_t r = static_cast<uint8_t>((base & 0xffu));
-                uint8_t g = static_cast<uint8_t>(((base >> 8) & 0xffu));
-                uint8_t bch = static_cast<uint8_t>(((base >> 16) & 0xffu));
-
-                // Modulate by Bayer to push energy out of low frequencies
-                float factor = (b + 1) / 64.0f; // 1..64 normalized
-                r = static_cast<uint8_t>(std::clamp(float(r) * factor, 0.0f, 255.0f));
-                g = static_cast<uint8_t>(std::clamp(float(g) * factor, 0.0f, 255.0f));
-                bch = static_cast<uint8_t>(std::clamp(float(bch) * factor, 0.0f, 255.0f));
-
                 size_t idx = (static_cast<size_t>(y) * width + x) * 3;
-                tex[idx + 0] = r;
-                tex[idx + 1] = g;
-                tex[idx + 2] = bch;
+                tex[idx + 0] = row[x][0];
+                tex[idx + 1] = row[x][1];
+                tex[idx + 2] = row[x][2];
             }
         }
         return tex;
     }
+
+private:
+    static uint32_t h32(uint32_t x)
+    {
+        x ^= x >> 17; x *= 0xED5AD4BBu;
+        x ^= x >> 11; x *= 0xAC4C1B51u;
+        x ^= x >> 15; x *= 0x31848BABu;
+        x ^= x >> 14;
+        return x;
+    }
+
+    static void offsets(uint32_t seed, int ox[3], int oy[3])
+    {
+        uint32_t h = h32(seed ^ 0x5bd1e995u);
+        for (int c = 0; c < 3; ++c) {
+            h = h32(h + static_cast<uint32_t>(c));
+            ox[c] = static_cast<int>(h & (kTileWidth - 1));
+            oy[c] = static_cast<int>((h >> 16) & (kTileHeight - 1));
+        }
+    }
+
+    // Best texel for one query, the tightest cluster (set texel of highest energy)
+    // or the largest void (empty texel of lowest energy), cached per 16x16 block.
+    // A splat only changes the blocks under its window, so a query rescans those
+    // instead of the whole tile. Ties go to the lower index.
+    class TexelSearch {
+    public:
+        TexelSearch(bool ones, bool highest) : ones(ones), highest(highest), best(kBlocks, -1), dirty(kBlocks, 1) {}
+
+        // Texel p changed and energies within radius of it moved (radius < kBlock)
+        void touched(int p, int radius)
+        {
+            const int px = p % kTileWidth, py = p / kTileWidth;
+            for (int dy : { -radius, radius }) {
+                for (int dx : { -radius, radius }) {
+                    const int bx = ((px + dx) & (kTileWidth - 1)) / kBlock;
+                    const int by = ((py + dy) & (kTileHeight - 1)) / kBlock;
+                    dirty[by * kBlocksX + bx] = 1;
+                }
+            }
+        }
+
+        int find(const std::vector<uint8_t>& bits, const std::vector<float>& energy)
+        {
+            int result = -1;
+            for (int k = 0; k < kBlocks; ++k) {
+                if (dirty[k]) {
+                    best[k] = scanBlock(k, bits, energy);
+                    dirty[k] = 0;
+                }
+                if (best[k] >= 0 && (result < 0 || better(energy, best[k], result))) result = best[k];
+            }
+            return result;
+        }
+
+    private:
+        static constexpr int kBlock = 16;
+        static constexpr int kBlocksX = kTileWidth / kBlock;
+        static constexpr int kBlocks = kBlocksX * (kTileHeight / kBlock);
+
+        bool ones, highest;
+        std::vector<int> best;
+        std::vector<uint8_t> dirty;
+
+        bool better(const std::vector<float>& e, int a, int b) const
+        {
+            if (e[a] != e[b]) return highest ? e[a] > e[b] : e[a] < e[b];
+            return a < b;
+        }
+
+        int scanBlock(int k, const std::vector<uint8_t>& bits, const std::vector<float>& energy) const
+        {
+            const int x0 = (k % kBlocksX) * kBlock, y0 = (k / kBlocksX) * kBlock;
+            int result = -1;
+            for (int y = y0; y < y0 + kBlock; ++y) {
+                for (int x = x0; x < x0 + kBlock; ++x) {
+                    const int p = y * kTileWidth + x;
+                    if ((bits[p] != 0) == ones && (result < 0 || better(energy, p, result))) result = p;
+                }
+            }
+            return result;
+        }
+    };
+
+    // Ulichney's void-and-cluster: rank every texel so that each prefix of the
+    // ranking is an evenly spread point set, then map ranks to 0..255.
+    static Tile buildTile(uint32_t salt)
+    {
+        constexpr int W = kTileWidth;
+        constexpr int H = kTileHeight;
+        constexpr float sigma = 1.5f;
+
+        // Toroidal Gaussian energy kernel, indexed by wrapped (dy, dx)
+        std::vector<float> kernel(kTileArea);
+        for (int dy = 0; dy < H; ++dy) {
+            for (int dx = 0; dx < W; ++dx) {
+                int wx = std::min(dx, W - dx);
+                int wy = std::min(dy, H - dy);
+                kernel[dy * W + dx] = std::exp(-float(wx * wx + wy * wy) / (2.0f * sigma * sigma));
+            }
+        }
+
+        std::vector<uint8_t> bits(kTileArea, 0);
+        std::vector<float> energy(kTileArea, 0.0f);
+
+        // The kernel is negligible beyond ~5 sigma, so only that window is updated
+        constexpr int radius = 7;
+        auto splat = [&](std::vector<float>& e, int p, float sign)
+            {
+                int py = p / W, px = p % W;
+                for (int dy = -radius; dy <= radius; ++dy) {
+                    const float* krow = kernel.data() + (dy & (H - 1)) * W;
+                    float* erow = e.data() + ((py + dy) & (H - 1)) * W;
+                    for (int dx = -radius; dx <= radius; ++dx) {
+                        erow[(px + dx) & (W - 1)] += sign * krow[dx & (W - 1)];
+                    }
+                }
+            };
+
+        // Initial random pattern (~10% ones)
+        const int initial = kTileArea / 10;
+        int ones = 0;
+        for (uint32_t k = 0; ones < initial; ++k) {
+            int p = static_cast<int>(h32(k * 0x27d4eb2du ^ salt) % kTileArea);
+            if (!bits[p]) {
+                bits[p] = 1;
+                splat(energy, p, 1.0f);
+                ++ones;
+            }
+        }
+
+        // Phase 0: move points from the tightest cluster into the largest void until stable
+        TexelSearch tightestCluster(true, true), largestVoid(false, false);
+        auto flip = [&](int p, uint8_t bit)
+            {
+                bits[p] = bit;
+                splat(energy, p, bit ? 1.0f : -1.0f);
+                tightestCluster.touched(p, radius);
+                largestVoid.touched(p, radius);
+            };
+        for (int guard = 0; guard < kTileArea; ++guard) {
+            int c = tightestCluster.find(bits, energy);
+            flip(c, 0);
+            int v = largestVoid.find(bits, energy);
+            flip(v, 1);
+            if (v == c) break;
+        }
+
+        std::vector<int> rank(kTileArea, 0);
+
+        // Phase 1: rank the initial points by removing tightest clusters
+        {
+            std::vector<uint8_t> b = bits;
+            std::vector<float> e = energy;
+            TexelSearch cluster(true, true);
+            for (int r = ones - 1; r >= 0; --r) {
+                int c = cluster.find(b, e);
+                b[c] = 0;
+                splat(e, c, -1.0f);
+                cluster.touched(c, radius);
+                rank[c] = r;
+            }
+        }
+
+        // Phase 2: fill the remaining texels, largest void first
+        for (int r = ones; r < kTileArea; ++r) {
+            int v = largestVoid.find(bits, energy);
+            flip(v, 1);
+            rank[v] = r;
+        }
+
+        Tile tile{};
+        for (int i = 0; i < kTileArea; ++i) {
+            tile[i] = static_cast<uint8_t>((rank[i] * 256) / kTileArea);
+        }
+        return tile;
+    }
 };
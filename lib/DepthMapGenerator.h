@@ -1,6 +1,7 @@
 // written by Paul Baxter
 #pragma once
 #include <array>
+#include <atomic>
 #include <vector>
 #include <limits>
 #include <algorithm>
@@ -10,6 +11,10 @@
 
 #include "stl.h"
 #include "Camera.h"
+#include "ForegroundSpans.h"
+#include "DepthPostProcessor.h"
+#include "Parallel.h"
+#include "Stats.h"
 
 // Compile-time toggle for backface culling (off by default).
 // Define MAGIC_EYE_ENABLE_CULLING=1 to enable in your build settings.
@@ -26,6 +31,24 @@ private:
         glm::vec3 cam; // camera-space xyz
     };
 
+    // Per raster tallies, handed to Stats once per add
+    struct RasterCounts {
+        uint64_t clipped = 0;
+        uint64_t culled = 0;
+        uint64_t tested = 0;
+    };
+
+    // A triangle set up in screen space, rasterized by every row band it covers
+    struct ScreenTri {
+        float px[3], py[3];
+        float invz[3];
+        float invDen;
+        int minx, maxx, miny, maxy;
+    };
+
+    static constexpr int kBandRows = 32;            // z-buffer rows owned by one raster task
+    static constexpr size_t kMinSetupBlock = 4096;  // triangles set up per task
+
     // Clip polygon (triangle) against plane z = near using Sutherland�Hodgman in camera space
     static inline std::vector<CamVert> clipAgainstNearPlane(const std::vector<CamVert>& in, float znear)
     {
@@ -75,66 +98,184 @@ private:
     }
 
 public:
-    // Public API kept identical
-    static inline std::vector<float> generate(const stl& mesh, int width, int height,
-        const Camera& cam, float ortho_scale,
-        float& out_zmin, float& out_zmax,
-        float depth_near, float depth_far,
-        float bg_separation)
-    {
-        std::vector<float> zbuffer(static_cast<size_t>(width) * height, INF);
-
-        glm::vec3 right, up_cam, forward;
-        cam.computeBasis(right, up_cam, forward);
-        float aspect = static_cast<float>(width) / std::max(1, height);
-
-        const size_t triCount = mesh.m_num_triangles;
-        const float* vdata = mesh.m_vectors.data();
+    /// <summary>
+    /// Incremental form of generate: triangles (9 floats each) may arrive in any
+    /// number of chunks, e.g. streamed from a file. The z-buffer keeps the nearest
+    /// depth, so the result does not depend on chunking or order.
+    /// Each chunk may carry a model matrix; it is folded into the camera transform,
+    /// so the vertex data is only read.
+    /// </summary>
+    class Raster {
+    public:
+        Raster(int width, int height, const Camera& cam, float ortho_scale)
+            : width(width), height(height), cam(cam), ortho_scale(ortho_scale),
+            zbuffer(static_cast<size_t>(width) * height, INF)
+        {
+            cam.computeBasis(right, up_cam, forward);
+            aspect = static_cast<float>(width) / std::max(1, height);
+            znear = std::max(cam.near_plane, Camera::kEpsilon);
+        }
 
-        const float znear = std::max(cam.near_plane, Camera::kEpsilon);
+        // Polled between triangle blocks and row bands; once it is set, add() returns
+        // early and leaves the z-buffer incomplete, which cancelled() reports
+        void setCancel(const std::atomic<bool>* flag) { cancel = flag; }
+        bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
+
+        void add(const float* vdata, size_t triCount, const glm::mat4& model = glm::mat4(1.0f))
+        {
+            if (cancelled()) return;
+            STATS_SCOPE("raster");
+            RasterCounts counts;
+
+            // Model to camera space in one affine map: rows are the camera axes
+            // applied to the model columns, the last column the moved origin
+            const glm::vec3 axes[3] = { right, up_cam, forward };
+            const glm::vec3 origin = glm::vec3(model[3].x, model[3].y, model[3].z) - cam.position;
+            float m[3][4];
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 3; ++c) {
+                    m[r][c] = glm::dot(axes[r], glm::vec3(model[c].x, model[c].y, model[c].z));
+                }
+                m[r][3] = glm::dot(axes[r], origin);
+            }
 
-        for (size_t t = 0; t < triCount; ++t) {
-            // Load world triangle
-            glm::vec3 vworld[3] = {
-                {vdata[t * 9 + 0], vdata[t * 9 + 1], vdata[t * 9 + 2]},
-                {vdata[t * 9 + 3], vdata[t * 9 + 4], vdata[t * 9 + 5]},
-                {vdata[t * 9 + 6], vdata[t * 9 + 7], vdata[t * 9 + 8]}
+            // Blocks of triangles are set up in parallel, each binning its triangles
+            // by the row bands they touch; then each band is rasterized by one task.
+            // A band owns its rows of the z-buffer and the nearest depth wins in any
+            // order, so the result is the same as a serial pass.
+            struct Block {
+                std::vector<ScreenTri> tris;
+                std::vector<std::vector<uint32_t>> bins;    // per band, indices into tris
+                RasterCounts counts;
             };
-
-            // To camera space
-            CamVert vcam[3];
-            for (int i = 0; i < 3; ++i) {
-                glm::vec3 rel = vworld[i] - cam.position;
-                vcam[i].cam.x = glm::dot(rel, right);
-                vcam[i].cam.y = glm::dot(rel, up_cam);
-                vcam[i].cam.z = glm::dot(rel, forward);
+            const int bands = (height + kBandRows - 1) / kBandRows;
+            const int blocks = std::clamp(static_cast<int>(triCount / kMinSetupBlock), 1, Parallel::threadCount() * 4);
+            std::vector<Block> setup(blocks);
+
+            Parallel::forRange(0, blocks, [&](int b0, int b1)
+                {
+                    for (int b = b0; b < b1; ++b) {
+                        if (cancelled()) return;
+                        Block& block = setup[b];
+                        block.bins.resize(bands);
+                        const size_t t0 = triCount * b / blocks, t1 = triCount * (b + 1) / blocks;
+                        for (size_t t = t0; t < t1; ++t) {
+                            // Model triangle straight to camera space
+                            CamVert vcam[3];
+                            for (int i = 0; i < 3; ++i) {
+                                const float* v = vdata + t * 9 + i * 3;
+                                vcam[i].cam.x = m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2] + m[0][3];
+                                vcam[i].cam.y = m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2] + m[1][3];
+                                vcam[i].cam.z = m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2] + m[2][3];
+                            }
+
+                            // Clip against near plane in camera space
+                            if (vcam[0].cam.z < znear || vcam[1].cam.z < znear || vcam[2].cam.z < znear) ++block.counts.clipped;
+                            std::vector<CamVert> triPoly = { vcam[0], vcam[1], vcam[2] };
+                            triPoly = clipAgainstNearPlane(triPoly, znear);
+                            if (triPoly.size() < 3) continue;
+
+                            // Triangulate
+                            std::vector<std::array<CamVert, 3>> clippedTris;
+                            clippedTris.reserve(triPoly.size() - 2);
+                            triangulateConvexFan(triPoly, clippedTris);
+
+                            // Set up each produced triangle and bin it
+                            for (const auto& ctri : clippedTris) {
+                                ScreenTri st;
+                                if (!setupTriangle(ctri.data(), cam, aspect, ortho_scale, width, height, st, block.counts)) continue;
+                                const uint32_t index = static_cast<uint32_t>(block.tris.size());
+                                block.tris.push_back(st);
+                                for (int k = st.miny / kBandRows; k <= st.maxy / kBandRows; ++k) block.bins[k].push_back(index);
+                            }
+                        }
+                    }
+                });
+            if (cancelled()) return;
+
+            Parallel::forRange(0, bands, [&](int k0, int k1)
+                {
+                    for (int k = k0; k < k1; ++k) {
+                        if (cancelled()) return;
+                        const int y0 = k * kBandRows;
+                        const int y1 = std::min(height - 1, y0 + kBandRows - 1);
+                        for (const Block& block : setup) {
+                            for (uint32_t index : block.bins[k]) {
+                                rasterizeRows(block.tris[index], y0, y1, cam.near_plane, width, zbuffer);
+                            }
+                        }
+                    }
+                });
+
+            for (const Block& block : setup) {
+                counts.clipped += block.counts.clipped;
+                counts.culled += block.counts.culled;
+                counts.tested += block.counts.tested;
             }
 
-            // Clip against near plane in camera space
-            std::vector<CamVert> triPoly = { vcam[0], vcam[1], vcam[2] };
-            triPoly = clipAgainstNearPlane(triPoly, znear);
-            if (triPoly.size() < 3) continue;
-
-            // Triangulate
-            std::vector<std::array<CamVert, 3>> clippedTris;
-            clippedTris.reserve(triPoly.size() - 2);
-            triangulateConvexFan(triPoly, clippedTris);
+            STATS_ADD(TrianglesIn, triCount);
+            STATS_ADD(TrianglesClipped, counts.clipped);
+            STATS_ADD(TrianglesCulled, counts.culled);
+            STATS_ADD(PixelsTested, counts.tested);
+        }
 
-            // Rasterize each produced triangle
-            for (const auto& ctri : clippedTris) {
-                processTriangle(ctri.data(), cam, aspect, ortho_scale, width, height, zbuffer);
+        std::vector<float> finish(float& out_zmin, float& out_zmax,
+            float depth_near, float depth_far,
+            float bg_separation, ForegroundSpans* out_spans = nullptr,
+            bool fill_holes = false, float fill_max_radius = 0.0f)
+        {
+            STATS_SCOPE("finalize");
+            if (fill_holes) {
+                DepthPostProcessor::fillEnclosedHoles(zbuffer, width, height, fill_max_radius);
             }
+
+            return finalizeDepthMap(zbuffer, width, height, out_zmin, out_zmax,
+                depth_near, depth_far, bg_separation, out_spans);
         }
 
-        return finalizeDepthMap(zbuffer, width, height, out_zmin, out_zmax,
-            depth_near, depth_far, bg_separation);
+    private:
+        int width, height;
+        Camera cam;
+        float ortho_scale;
+        std::vector<float> zbuffer;
+        glm::vec3 right, up_cam, forward;
+        float aspect, znear;
+        const std::atomic<bool>* cancel = nullptr;
+    };
+
+    // Public API kept identical; out_spans optionally receives the covered pixel runs per row.
+    // fill_holes closes enclosed gaps in the surface from the nearest covered pixel
+    // (only holes within fill_max_radius pixels when that is > 0).
+    static inline std::vector<float> generate(const stl& mesh, int width, int height,
+        const Camera& cam, float ortho_scale,
+        float& out_zmin, float& out_zmax,
+        float depth_near, float depth_far,
+        float bg_separation, ForegroundSpans* out_spans = nullptr,
+        bool fill_holes = false, float fill_max_radius = 0.0f)
+    {
+        return generate(mesh, glm::mat4(1.0f), width, height, cam, ortho_scale, out_zmin, out_zmax,
+            depth_near, depth_far, bg_separation, out_spans, fill_holes, fill_max_radius);
+    }
+
+    // The mesh in model space, placed by model; the mesh itself is not modified
+    static inline std::vector<float> generate(const stl& mesh, const glm::mat4& model, int width, int height,
+        const Camera& cam, float ortho_scale,
+        float& out_zmin, float& out_zmax,
+        float depth_near, float depth_far,
+        float bg_separation, ForegroundSpans* out_spans = nullptr,
+        bool fill_holes = false, float fill_max_radius = 0.0f)
+    {
+        Raster raster(width, height, cam, ortho_scale);
+        raster.add(mesh.m_vectors.data(), mesh.m_num_triangles, model);
+        return raster.finish(out_zmin, out_zmax, depth_near, depth_far,
+            bg_separation, out_spans, fill_holes, fill_max_radius);
     }
 
 private:
-    // Triangle processing with perspective-correct depth interpolation
-    static inline void processTriangle(const CamVert* tri_cam,
+    // Project a camera space triangle to pixels; false if nothing of it can be drawn
+    static inline bool setupTriangle(const CamVert* tri_cam,
         const Camera& cam, float aspect, float ortho_scale,
-        int width, int height, std::vector<float>& zbuffer)
+        int width, int height, ScreenTri& out, RasterCounts& counts)
     {
         // Project to NDC
         float ndc_x[3]{}, ndc_y[3]{};
@@ -150,7 +291,7 @@ private:
                 p_for_ndc.y /= ortho_scale;
             }
             ok[i] = cam.projectToNDC(p_for_ndc, aspect, ndc_x[i], ndc_y[i], zcam[i]);
-            if (!ok[i]) return; // clipped already by near; safety
+            if (!ok[i]) return false; // clipped already by near; safety
             invz[i] = 1.0f / std::max(zcam[i], Camera::kEpsilon);
         }
 
@@ -159,7 +300,8 @@ private:
         float area2 = (ndc_x[1] - ndc_x[0]) * (ndc_y[2] - ndc_y[0]) - (ndc_x[2] - ndc_x[0]) * (ndc_y[1] - ndc_y[0]);
         if (area2 > 0.0f) {
             // Cull clockwise (assuming standard convention). Remove if two-sided desired.
-            return;
+            ++counts.culled;
+            return false;
         }
 #endif
 
@@ -178,11 +320,37 @@ private:
         int maxy = std::min(height - 1, static_cast<int>(std::ceil(std::max({ py[0], py[1], py[2] }))));
 
         float denom = (py[1] - py[2]) * (px[0] - px[2]) + (px[2] - px[1]) * (py[0] - py[2]);
-        if (std::fabs(denom) < tolerance) return;
-        float invDen = 1.0f / denom;
+        if (std::fabs(denom) < tolerance) {
+            ++counts.culled;    // degenerate in screen space
+            return false;
+        }
+        if (maxx < minx || maxy < miny) return false;
+        counts.tested += static_cast<uint64_t>(maxx - minx + 1) * (maxy - miny + 1);
+
+        for (int i = 0; i < 3; ++i) {
+            out.px[i] = px[i];
+            out.py[i] = py[i];
+            out.invz[i] = invz[i];
+        }
+        out.invDen = 1.0f / denom;
+        out.minx = minx;
+        out.maxx = maxx;
+        out.miny = miny;
+        out.maxy = maxy;
+        return true;
+    }
 
-        for (int y = miny; y <= maxy; ++y) {
-            for (int x = minx; x <= maxx; ++x) {
+    // Scan the rows [y0, y1] of a set up triangle with perspective-correct depth interpolation
+    static inline void rasterizeRows(const ScreenTri& tri, int y0, int y1, float near_plane,
+        int width, std::vector<float>& zbuffer)
+    {
+        const float* px = tri.px;
+        const float* py = tri.py;
+        const float* invz = tri.invz;
+        const float invDen = tri.invDen;
+
+        for (int y = std::max(y0, tri.miny); y <= std::min(y1, tri.maxy); ++y) {
+            for (int x = tri.minx; x <= tri.maxx; ++x) {
                 float cx = x + 0.5f;
                 float cy = y + 0.5f;
 
@@ -196,7 +364,7 @@ private:
                 // Perspective-correct depth (interpolate 1/z and invert)
                 float invz_interp = u * invz[0] + v * invz[1] + w * invz[2];
                 float z_interp = 1.0f / std::max(invz_interp, Camera::kEpsilon);
-                if (z_interp <= cam.near_plane) continue;
+                if (z_interp <= near_plane) continue;
 
                 int idx = y * width + x;
                 if (z_interp < zbuffer[idx]) {
@@ -209,7 +377,7 @@ private:
     static inline std::vector<float> finalizeDepthMap(const std::vector<float>& zbuffer, int width, int height,
         float& out_zmin, float& out_zmax,
         float depth_near, float depth_far,
-        float bg_separation)
+        float bg_separation, ForegroundSpans* out_spans)
     {
         out_zmin = INF;
         out_zmax = -INF;
@@ -226,20 +394,36 @@ private:
 
         std::vector<float> depth(static_cast<size_t>(width) * height, 0.0f);
         if (!std::isfinite(out_zmin) || !std::isfinite(extended_zmax)) {
+            if (out_spans) out_spans->reset(width, height, 0.0f);
             return depth;
         }
 
         float range = extended_zmax - out_zmin;
         if (range < tolerance) range = 1.0f;
 
-        for (int i = 0; i < width * height; ++i) {
-            float z = zbuffer[i];
-            if (!std::isfinite(z)) {
-                depth[i] = depth_far;
+        if (out_spans) out_spans->reset(width, height, depth_far);
+
+        for (int y = 0; y < height; ++y) {
+            int runStart = -1;
+            for (int x = 0; x < width; ++x) {
+                int i = y * width + x;
+                float z = zbuffer[i];
+                if (!std::isfinite(z)) {
+                    depth[i] = depth_far;
+                    if (runStart >= 0) {
+                        if (out_spans) out_spans->spans.push_back({ runStart, x });
+                        runStart = -1;
+                    }
+                }
+                else {
+                    float t = (z - out_zmin) / range;
+                    depth[i] = depth_near + (depth_far - depth_near) * t;
+                    if (runStart < 0) runStart = x;
+                }
             }
-            else {
-                float t = (z - out_zmin) / range;
-                depth[i] = depth_near + (depth_far - depth_near) * t;
+            if (out_spans) {
+                if (runStart >= 0) out_spans->spans.push_back({ runStart, width });
+                out_spans->endRow(y);
             }
         }
 
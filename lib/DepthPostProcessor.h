@@ -4,6 +4,9 @@
 #include <cmath>
 #include <algorithm>
 #include <limits>
+#include <atomic>
+
+#include "Parallel.h"
 
 class DepthPostProcessor {
 public:
@@ -27,41 +30,423 @@ public:
         }
     }
 
-    // Edge-preserving bilateral filter for softening jagged depth edges
-    static void bilateralSmooth(std::vector<float>& depth, int width, int height, float sigmaSpatial = 1.5f, float sigmaRange = 0.15f, int iterations = 1)
+    /// <summary>
+    /// Fill holes (non-finite pixels) enclosed by valid pixels with the value of the
+    /// nearest valid pixel, whatever their size. Runs of invalid pixels connected to
+    /// the image border are background and stay untouched. With maxRadius > 0 only
+    /// holes whose farthest pixel is within maxRadius of a valid pixel are filled,
+    /// which keeps real openings (the middle of a ring) from being closed.
+    /// Linear time: a parallel union-find labelling plus an exact Euclidean feature transform.
+    /// </summary>
+    static void fillEnclosedHoles(std::vector<float>& values, int width, int height, float maxRadius = 0.0f)
+    {
+        if (width <= 0 || height <= 0 || values.size() < static_cast<size_t>(width) * height) return;
+        const size_t n = static_cast<size_t>(width) * height;
+
+        // Component of every invalid pixel, as the index of its first pixel; -1 = valid
+        std::vector<int> label;
+        labelInvalid(values, width, height, label);
+
+        // fill[root]: the component is enclosed (and, with maxRadius, small enough)
+        std::vector<uint8_t> fill(n, 1);
+        auto open = [&](size_t i) { if (label[i] >= 0) fill[label[i]] = 0; };
+        for (int x = 0; x < width; ++x) {
+            open(x);
+            open(static_cast<size_t>(height - 1) * width + x);
+        }
+        for (int y = 0; y < height; ++y) {
+            open(static_cast<size_t>(y) * width);
+            open(static_cast<size_t>(y) * width + width - 1);
+        }
+
+        std::vector<uint8_t> valid(n);
+        std::atomic<bool> holes{ false };
+        Parallel::forRange(0, height, [&](int y0, int y1)
+            {
+                bool found = false;
+                for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; ++i) {
+                    valid[i] = label[i] < 0;
+                    found = found || (label[i] >= 0 && fill[label[i]]);
+                }
+                if (found) holes = true;
+            }, 16);
+        if (!holes) return;
+
+        std::vector<int> nearest;
+        std::vector<float> dist2;
+        nearestValid(valid, width, height, nearest, &dist2);
+
+        // Reject holes too large to be a gap in the surface
+        if (maxRadius > 0.0f) {
+            std::vector<float> worst(n, 0.0f);
+            for (size_t i = 0; i < n; ++i) {
+                if (label[i] >= 0 && fill[label[i]]) worst[label[i]] = std::max(worst[label[i]], dist2[i]);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (label[i] == static_cast<int>(i) && worst[i] > maxRadius * maxRadius) fill[i] = 0;
+            }
+        }
+
+        Parallel::forRange(0, height, [&](int y0, int y1)
+            {
+                for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; ++i) {
+                    if (label[i] >= 0 && fill[label[i]] && nearest[i] >= 0) values[i] = values[nearest[i]];
+                }
+            }, 16);
+    }
+
+    /// <summary>
+    /// Exact Euclidean feature transform (Felzenszwalb & Huttenlocher): for every
+    /// pixel the index of the nearest pixel with valid != 0, or -1 if there is none.
+    /// Optionally also the squared distance. Columns, then rows, each in parallel.
+    /// </summary>
+    static void nearestValid(const std::vector<uint8_t>& valid, int width, int height,
+        std::vector<int>& nearest, std::vector<float>* dist2 = nullptr)
     {
-        if (depth.empty()) return;
-        std::vector<float> out(depth.size(), 0.0f);
+        const size_t n = static_cast<size_t>(width) * height;
+        nearest.assign(n, -1);
+        if (dist2) dist2->assign(n, std::numeric_limits<float>::infinity());
+
+        // Pass 1: nearest valid row in the same column (two sweeps, row-major friendly)
+        std::vector<int> colNear(n, -1);
+        Parallel::forRange(0, width, [&](int x0, int x1)
+            {
+                for (int y = 0; y < height; ++y) {
+                    const size_t row = static_cast<size_t>(y) * width;
+                    for (int x = x0; x < x1; ++x) {
+                        if (valid[row + x]) colNear[row + x] = y;
+                        else if (y > 0) colNear[row + x] = colNear[row - width + x];
+                    }
+                }
+                for (int y = height - 2; y >= 0; --y) {
+                    const size_t row = static_cast<size_t>(y) * width;
+                    for (int x = x0; x < x1; ++x) {
+                        int below = colNear[row + width + x];
+                        int cur = colNear[row + x];
+                        if (below >= 0 && (cur < 0 || below - y < y - cur)) colNear[row + x] = below;
+                    }
+                }
+            }, 64);
+
+        // Pass 2: lower envelope of the parabolas (x - q)^2 + g(q)^2 along each row
+        Parallel::forRange(0, height, [&](int y0, int y1)
+            {
+                std::vector<int> v(width);
+                std::vector<double> z(static_cast<size_t>(width) + 1);
+                std::vector<double> f(width);
+                for (int y = y0; y < y1; ++y) {
+                    const size_t row = static_cast<size_t>(y) * width;
+                    int k = -1;
+                    for (int q = 0; q < width; ++q) {
+                        int ny = colNear[row + q];
+                        if (ny < 0) continue;
+                        f[q] = double(ny - y) * double(ny - y);
+                        while (k >= 0) {
+                            int p = v[k];
+                            double s = ((f[q] + double(q) * q) - (f[p] + double(p) * p)) / (2.0 * (q - p));
+                            if (s > z[k]) break;
+                            --k;
+                        }
+                        if (k < 0) {
+                            v[0] = q;
+                            z[0] = -std::numeric_limits<double>::infinity();
+                            k = 0;
+                        }
+                        else {
+                            int p = v[k];
+                            ++k;
+                            v[k] = q;
+                            z[k] = ((f[q] + double(q) * q) - (f[p] + double(p) * p)) / (2.0 * (q - p));
+                        }
+                        z[k + 1] = std::numeric_limits<double>::infinity();
+                    }
+                    if (k < 0) continue;
 
-        int radius = std::max(1, int(std::ceil(2.0f * sigmaSpatial)));
-        auto gauss = [&](float x, float s) { return std::exp(-(x * x) / (2.0f * s * s)); };
+                    int j = 0;
+                    for (int x = 0; x < width; ++x) {
+                        while (z[j + 1] < x) ++j;
+                        int q = v[j];
+                        nearest[row + x] = colNear[row + q] * width + q;
+                        if (dist2) (*dist2)[row + x] = static_cast<float>(double(x - q) * (x - q) + f[q]);
+                    }
+                }
+            }, 8);
+    }
+
+    /// <summary>
+    /// Edge-preserving bilateral filter for softening jagged depth edges.
+    /// Small spatial sigmas run an exact filter with a precomputed spatial kernel
+    /// and a quantized range-weight LUT; from kGridSigma up a bilateral grid
+    /// approximation is used, whose cost does not grow with the radius.
+    /// Non-finite pixels are left untouched and never contribute.
+    /// </summary>
+    static void bilateralSmooth(std::vector<float>& depth, int width, int height, float sigmaSpatial = 1.5f, float sigmaRange = 0.15f, int iterations = 1)
+    {
+        if (depth.empty() || width <= 0 || height <= 0 || sigmaSpatial <= 0.0f || sigmaRange <= 0.0f) return;
+        if (depth.size() < static_cast<size_t>(width) * height) return;
 
+        std::vector<float> out(depth.size());
         for (int it = 0; it < iterations; ++it) {
-            for (int y = 0; y < height; ++y) {
-                for (int x = 0; x < width; ++x) {
-                    int idx = y * width + x;
-                    float center = depth[idx];
-                    if (!std::isfinite(center)) { out[idx] = depth[idx]; continue; }
+            if (sigmaSpatial >= kGridSigma) {
+                bilateralGrid(depth, out, width, height, sigmaSpatial, sigmaRange);
+            }
+            else {
+                bilateralDirect(depth, out, width, height, sigmaSpatial, sigmaRange);
+            }
+            depth.swap(out);
+        }
+    }
+
+    static constexpr float kGridSigma = 4.0f;
+
+private:
+    /// <summary>
+    /// 4-connected components of the non-finite pixels: label[i] is the index of the
+    /// component's first pixel (row-major), -1 for a finite pixel. Union-find in
+    /// horizontal strips, one task each; the strip seams are then joined in one
+    /// serial pass over a row per strip, and the roots resolved in parallel.
+    /// </summary>
+    static void labelInvalid(const std::vector<float>& values, int width, int height, std::vector<int>& label)
+    {
+        const size_t n = static_cast<size_t>(width) * height;
+        std::vector<int> parent(n);
+
+        // Roots are the smallest index of their set, so a parent never lies past its child
+        // and unions inside a strip stay inside it
+        auto find = [&](int i)
+            {
+                while (parent[i] != i) {
+                    parent[i] = parent[parent[i]];
+                    i = parent[i];
+                }
+                return i;
+            };
+        auto unite = [&](int a, int b)
+            {
+                a = find(a);
+                b = find(b);
+                if (a < b) parent[b] = a;
+                else if (b < a) parent[a] = b;
+            };
+
+        const int strips = std::min(height, Parallel::threadCount() * kLabelStripsPerThread);
+        auto stripStart = [&](int s) { return static_cast<int>(static_cast<long long>(height) * s / strips); };
+        Parallel::forRange(0, strips, [&](int s0, int s1)
+            {
+                for (int s = s0; s < s1; ++s) {
+                    const int y0 = stripStart(s), y1 = stripStart(s + 1);
+                    for (int y = y0; y < y1; ++y) {
+                        const int row = y * width;
+                        for (int x = 0; x < width; ++x) {
+                            const int i = row + x;
+                            if (std::isfinite(values[i])) {
+                                parent[i] = -1;
+                                continue;
+                            }
+                            parent[i] = i;
+                            if (x > 0 && parent[i - 1] >= 0) unite(i, i - 1);
+                            if (y > y0 && parent[i - width] >= 0) unite(i, i - width);
+                        }
+                    }
+                }
+            });
+
+        for (int s = 1; s < strips; ++s) {
+            const int row = stripStart(s) * width;
+            for (int x = 0; x < width; ++x) {
+                if (parent[row + x] >= 0 && parent[row - width + x] >= 0) unite(row + x, row - width + x);
+            }
+        }
+
+        // Read-only walk to the root; parent is no longer written
+        label.resize(n);
+        Parallel::forRange(0, height, [&](int y0, int y1)
+            {
+                for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; ++i) {
+                    int r = parent[i];
+                    if (r >= 0) {
+                        while (parent[r] != r) r = parent[r];
+                    }
+                    label[i] = r;
+                }
+            }, 16);
+    }
+
+    static constexpr int kRangeBins = 1024;
+    static constexpr float kRangeCutoff = 4.0f;     // range weights beyond 4 sigma are treated as 0
+    static constexpr float kMaxGridDepth = 256.0f;  // depth cells of the bilateral grid, at most
+    static constexpr int kLabelStripsPerThread = 4; // hole labelling strips, a few per thread for balance
+
+    static void bilateralDirect(const std::vector<float>& src, std::vector<float>& dst,
+        int width, int height, float sigmaSpatial, float sigmaRange)
+    {
+        const int radius = std::max(1, int(std::ceil(2.0f * sigmaSpatial)));
+        const int ksize = 2 * radius + 1;
+
+        std::vector<float> spatial(static_cast<size_t>(ksize) * ksize);
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                spatial[(dy + radius) * ksize + dx + radius] = std::exp(-float(dx * dx + dy * dy) / (2.0f * sigmaSpatial * sigmaSpatial));
+            }
+        }
+
+        // lut[i] = exp(-d^2 / 2 sr^2) for |d| = i / binScale, last bin is 0
+        const float binScale = (kRangeBins - 1) / (kRangeCutoff * sigmaRange);
+        std::vector<float> range(kRangeBins + 1, 0.0f);
+        for (int i = 0; i < kRangeBins; ++i) {
+            float d = i / binScale;
+            range[i] = std::exp(-(d * d) / (2.0f * sigmaRange * sigmaRange));
+        }
+        range[kRangeBins - 1] = 0.0f;
+        const float maxBin = static_cast<float>(kRangeBins - 1);
 
-                    float wsum = 0.0f;
-                    float vsum = 0.0f;
+        Parallel::forRange(0, height, [&](int y0, int y1)
+            {
+                std::vector<float> wsum(width), vsum(width);
+                for (int y = y0; y < y1; ++y) {
+                    const float* center = src.data() + static_cast<size_t>(y) * width;
+                    std::fill(wsum.begin(), wsum.end(), 0.0f);
+                    std::fill(vsum.begin(), vsum.end(), 0.0f);
+
+                    // Tap-major: each (dy, dx) is one branch free pass over the row
                     for (int dy = -radius; dy <= radius; ++dy) {
-                        int yy = y + dy; if (yy < 0 || yy >= height) continue;
+                        int yy = y + dy;
+                        if (yy < 0 || yy >= height) continue;
+                        const float* row = src.data() + static_cast<size_t>(yy) * width;
+                        const float* krow = spatial.data() + (dy + radius) * ksize + radius;
+
                         for (int dx = -radius; dx <= radius; ++dx) {
-                            int xx = x + dx; if (xx < 0 || xx >= width) continue;
-                            int j = yy * width + xx;
-                            float v = depth[j];
-                            if (!std::isfinite(v)) continue;
-
-                            float w = gauss(std::sqrt(float(dx * dx + dy * dy)), sigmaSpatial) * gauss(v - center, sigmaRange);
-                            wsum += w;
-                            vsum += w * v;
+                            const float ks = krow[dx];
+                            const int xb = std::max(0, -dx);
+                            const int xe = std::min(width, width - dx);
+                            for (int x = xb; x < xe; ++x) {
+                                float v = row[x + dx];
+                                float d = std::fabs(v - center[x]) * binScale;
+                                // NaN/inf taps land in the zero bin; the weighted value is masked too
+                                int bin = static_cast<int>(d < maxBin ? d : maxBin);
+                                float w = ks * range[bin];
+                                wsum[x] += w;
+                                vsum[x] += w > 0.0f ? w * v : 0.0f;
+                            }
                         }
                     }
-                    out[idx] = (wsum > 0.0f) ? (vsum / wsum) : center;
+
+                    float* out = dst.data() + static_cast<size_t>(y) * width;
+                    for (int x = 0; x < width; ++x) {
+                        float c = center[x];
+                        out[x] = (std::isfinite(c) && wsum[x] > 0.0f) ? vsum[x] / wsum[x] : c;
+                    }
                 }
+            }, 8);
+    }
+
+    // Paris & Durand bilateral grid: splat into a coarse (x, y, depth) grid,
+    // blur it with a separable [1 2 1] kernel, then slice trilinearly.
+    static void bilateralGrid(const std::vector<float>& src, std::vector<float>& dst,
+        int width, int height, float sigmaSpatial, float sigmaRange)
+    {
+        float lo = std::numeric_limits<float>::infinity();
+        float hi = -std::numeric_limits<float>::infinity();
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i) {
+            if (std::isfinite(src[i])) {
+                lo = std::min(lo, src[i]);
+                hi = std::max(hi, src[i]);
             }
-            depth.swap(out);
         }
+        if (!(lo <= hi)) {
+            dst = src;
+            return;
+        }
+
+        // Depth cells are sigmaRange deep, but never more than kMaxGridDepth of them:
+        // a tiny sigmaRange would otherwise ask for gigabytes of grid
+        const float zStep = std::max(sigmaRange, (hi - lo) / kMaxGridDepth);
+
+        const int pad = 2;
+        const int gw = int((width - 1) / sigmaSpatial) + 1 + 2 * pad;
+        const int gh = int((height - 1) / sigmaSpatial) + 1 + 2 * pad;
+        const int gd = int((hi - lo) / zStep) + 1 + 2 * pad;
+        const size_t cells = static_cast<size_t>(gw) * gh * gd;
+        auto cell = [&](int gx, int gy, int gz) { return (static_cast<size_t>(gy) * gw + gx) * gd + gz; };
+
+        // (value, weight) pairs, nearest cell splat. Parallel over grid rows: each task
+        // owns the image rows that land in its grid rows, so no cell is shared
+        std::vector<float> grid(cells * 2, 0.0f);
+        Parallel::forRange(0, gh, [&](int g0, int g1)
+            {
+                for (int y = 0; y < height; ++y) {
+                    int gy = int(y / sigmaSpatial + 0.5f) + pad;
+                    if (gy < g0 || gy >= g1) continue;
+                    for (int x = 0; x < width; ++x) {
+                        float v = src[static_cast<size_t>(y) * width + x];
+                        if (!std::isfinite(v)) continue;
+                        int gx = int(x / sigmaSpatial + 0.5f) + pad;
+                        int gz = int((v - lo) / zStep + 0.5f) + pad;
+                        size_t c = cell(gx, gy, gz) * 2;
+                        grid[c] += v;
+                        grid[c + 1] += 1.0f;
+                    }
+                }
+            });
+
+        // Separable blur along z, x, y; each pass is parallel over grid rows
+        std::vector<float> tmp(grid.size());
+        auto blurAxis = [&](int axis)
+            {
+                const long long stride = axis == 0 ? 2 : axis == 1 ? 2LL * gd : 2LL * gd * gw;
+                const int len = axis == 0 ? gd : axis == 1 ? gw : gh;
+                Parallel::forRange(0, gh, [&](int y0, int y1)
+                    {
+                        for (int gy = y0; gy < y1; ++gy) {
+                            for (int gx = 0; gx < gw; ++gx) {
+                                for (int gz = 0; gz < gd; ++gz) {
+                                    const int pos = axis == 0 ? gz : axis == 1 ? gx : gy;
+                                    const size_t c = cell(gx, gy, gz) * 2;
+                                    for (int k = 0; k < 2; ++k) {
+                                        float m = grid[c + k] * 2.0f;
+                                        if (pos > 0) m += grid[c + k - stride];
+                                        if (pos + 1 < len) m += grid[c + k + stride];
+                                        tmp[c + k] = m * 0.25f;
+                                    }
+                                }
+                            }
+                        }
+                    });
+                grid.swap(tmp);
+            };
+        blurAxis(0);
+        blurAxis(1);
+        blurAxis(2);
+
+        Parallel::forRange(0, height, [&](int y0, int y1)
+            {
+                for (int y = y0; y < y1; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        size_t i = static_cast<size_t>(y) * width + x;
+                        float v = src[i];
+                        if (!std::isfinite(v)) {
+                            dst[i] = v;
+                            continue;
+                        }
+                        float fx = x / sigmaSpatial + pad;
+                        float fy = y / sigmaSpatial + pad;
+                        float fz = (v - lo) / zStep + pad;
+                        int ix = std::min(int(fx), gw - 2);
+                        int iy = std::min(int(fy), gh - 2);
+                        int iz = std::min(int(fz), gd - 2);
+                        float tx = fx - ix, ty = fy - iy, tz = fz - iz;
+
+                        float acc[2] = { 0.0f, 0.0f };
+                        for (int c = 0; c < 8; ++c) {
+                            int ox = c & 1, oy = (c >> 1) & 1, oz = c >> 2;
+                            float w = (ox ? tx : 1.0f - tx) * (oy ? ty : 1.0f - ty) * (oz ? tz : 1.0f - tz);
+                            size_t g = cell(ix + ox, iy + oy, iz + oz) * 2;
+                            acc[0] += w * grid[g];
+                            acc[1] += w * grid[g + 1];
+                        }
+                        dst[i] = acc[1] > 1e-6f ? acc[0] / acc[1] : v;
+                    }
+                }
+            }, 8);
     }
 };
@@ -2,6 +2,12 @@
 #pragma once
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "Parallel.h"
+#include "ForegroundSpans.h"
 
 class EdgeSmoother {
 public:
@@ -11,38 +17,161 @@ public:
     {
         if (width < 3 || height < 3) return;
 
+        const Span full{ 1, width - 1 };
+        smoothRows(adjusted_depth, out_rgb, smoothThreshold, smoothWeight, width, 1, height - 1,
+            [&](int) { return std::make_pair(&full, &full + 1); });
+    }
+
+    /// <summary>
+    /// Same as above, but only visits the covered pixel runs of the depth map.
+    /// backgroundDepth is the adjusted depth of every pixel outside the spans; if
+    /// it passes the threshold the whole frame is smoothed as before.
+    /// </summary>
+    static void applyEdgeSmoothing(const std::vector<float>& adjusted_depth, const ForegroundSpans& spans,
+        float backgroundDepth, std::vector<uint8_t>& out_rgb, float smoothThreshold, float smoothWeight,
+        int width, int height)
+    {
+        if (width < 3 || height < 3) return;
+        if (!spans.valid() || spans.width != width || spans.height != height || backgroundDepth > smoothThreshold) {
+            applyEdgeSmoothing(adjusted_depth, out_rgb, smoothThreshold, smoothWeight, width, height);
+            return;
+        }
+
+        // Clip spans to the interior once; rows outside [yFirst, yLast] have nothing to do
+        std::vector<int> rowStart(static_cast<size_t>(height) + 1, 0);
+        std::vector<Span> clipped;
+        clipped.reserve(spans.spans.size());
+        int yFirst = height, yLast = -1;
+        for (int y = 0; y < height; ++y) {
+            if (y >= 1 && y < height - 1) {
+                for (const Span* s = spans.rowBegin(y); s != spans.rowEnd(y); ++s) {
+                    int x0 = std::max(s->x0, 1);
+                    int x1 = std::min(s->x1, width - 1);
+                    if (x0 < x1) clipped.push_back({ x0, x1 });
+                }
+            }
+            rowStart[static_cast<size_t>(y) + 1] = static_cast<int>(clipped.size());
+            if (rowStart[y + 1] > rowStart[y]) {
+                yFirst = std::min(yFirst, y);
+                yLast = y;
+            }
+        }
+        if (yLast < 0) return;
+
+        smoothRows(adjusted_depth, out_rgb, smoothThreshold, smoothWeight, width, yFirst, yLast + 1,
+            [&](int y) { return std::make_pair(clipped.data() + rowStart[y], clipped.data() + rowStart[y + 1]); });
+    }
+
+private:
+    using Span = ForegroundSpans::Span;
+
+    struct Weights {
+        uint32_t orig = 65536;
+        uint32_t mean = 0;
+    };
+
+    // Smooth the spans of rows [yBegin, yEnd) in place; rowSpans(y) yields the (begin, end) span pointers of row y
+    template <typename RowSpans>
+    static void smoothRows(const std::vector<float>& adjusted_depth, std::vector<uint8_t>& out_rgb,
+        float smoothThreshold, float smoothWeight, int width,
+        int yBegin, int yEnd, RowSpans&& rowSpans)
+    {
         // Strength: larger smoothWeight -> milder smoothing
         float alpha = 1.0f / std::max(1.0f, smoothWeight);
 
-        // Read from a stable source buffer while writing to out_rgb
-        std::vector<uint8_t> src = out_rgb;
-
-        for (int y = 1; y < height - 1; ++y) {
-            for (int x = 1; x < width - 1; ++x) {
-                float d = adjusted_depth[y * width + x];
-                if (d <= smoothThreshold) continue;
-
-                int basePix = y * width + x;
-                int neighbors[9] = {
-                    basePix - width - 1, basePix - width, basePix - width + 1,
-                    basePix - 1,         basePix,         basePix + 1,
-                    basePix + width - 1, basePix + width, basePix + width + 1
-                };
-
-                int idx_center = basePix * 3;
-                for (int c = 0; c < 3; ++c) {
-                    float sum = 0.0f;
-                    for (int k = 0; k < 9; ++k) {
-                        int idxn = neighbors[k] * 3 + c;
-                        sum += src[idxn];
+        // 16.16 fixed point: out = (orig * w_orig + sum9 * w_mean) >> 16
+        Weights wt;
+        wt.orig = static_cast<uint32_t>(65536 - std::lround(alpha * 65536.0f));
+        wt.mean = static_cast<uint32_t>(std::lround(alpha * 65536.0f / 9.0f));
+
+        // Rows are split into bands. Inside a band each row result is held back
+        // until the next row has been computed, so reads always see the original
+        // pixels. A band's first and last rows are also read by its neighbours,
+        // so they are written only after every band has finished.
+        const int rows = yEnd - yBegin;
+        const int bands = std::clamp(rows / 32, 1, Parallel::threadCount() * 4);
+        const size_t stride = static_cast<size_t>(width) * 3;
+
+        struct Band {
+            std::vector<uint8_t> first;
+            std::vector<uint8_t> last;
+            int y0 = 0;
+            int y1 = 0;
+        };
+        std::vector<Band> deferred(bands);
+
+        auto writeRow = [&](int y, const uint8_t* src)
+            {
+                auto [s, e] = rowSpans(y);
+                for (; s != e; ++s) {
+                    std::memcpy(out_rgb.data() + y * stride + s->x0 * 3, src + s->x0 * 3, static_cast<size_t>(s->x1 - s->x0) * 3);
+                }
+            };
+
+        Parallel::forRange(0, bands, [&](int b0, int b1)
+            {
+                std::vector<uint16_t> vsum(stride);
+                std::vector<uint8_t> pending[2] = { std::vector<uint8_t>(stride), std::vector<uint8_t>(stride) };
+
+                for (int b = b0; b < b1; ++b) {
+                    Band& band = deferred[b];
+                    band.y0 = yBegin + static_cast<int>(static_cast<long long>(rows) * b / bands);
+                    band.y1 = yBegin + static_cast<int>(static_cast<long long>(rows) * (b + 1) / bands);
+
+                    for (int y = band.y0; y < band.y1; ++y) {
+                        std::vector<uint8_t>& cur = pending[y & 1];
+                        auto [s, e] = rowSpans(y);
+                        for (; s != e; ++s) {
+                            smoothSpan(adjusted_depth, out_rgb, y, width, s->x0, s->x1, smoothThreshold, wt, vsum.data(), cur.data());
+                        }
+
+                        if (y == band.y0) {
+                            band.first = cur;
+                        }
+                        else if (y - 1 > band.y0) {
+                            writeRow(y - 1, pending[(y - 1) & 1].data());
+                        }
+                    }
+                    if (band.y1 - 1 > band.y0) {
+                        band.last = pending[(band.y1 - 1) & 1];
                     }
-                    float mean = sum / 9.0f;
-                    float orig = src[idx_center + c];
-                    float blended = orig * (1.0f - alpha) + mean * alpha;
-                    blended = std::clamp(blended, 0.0f, 255.0f);
-                    out_rgb[idx_center + c] = static_cast<uint8_t>(blended);
                 }
+            });
+
+        for (const Band& band : deferred) {
+            if (!band.first.empty()) writeRow(band.y0, band.first.data());
+            if (!band.last.empty()) writeRow(band.y1 - 1, band.last.data());
+        }
+    }
+
+    // Compute smoothed pixels [x0, x1) of row y into result (indexed like a full row)
+    // using separable 3x3 sums of the unmodified rows y-1..y+1
+    static void smoothSpan(const std::vector<float>& adjusted_depth, const std::vector<uint8_t>& rgb,
+        int y, int width, int x0, int x1, float smoothThreshold, const Weights& wt,
+        uint16_t* vsum, uint8_t* result)
+    {
+        const size_t stride = static_cast<size_t>(width) * 3;
+        const uint8_t* top = rgb.data() + (y - 1) * stride;
+        const uint8_t* mid = top + stride;
+        const uint8_t* bot = mid + stride;
+
+        // Vertical pass over the span plus one pixel either side
+        const size_t i0 = static_cast<size_t>(x0 - 1) * 3;
+        const size_t i1 = static_cast<size_t>(x1 + 1) * 3;
+        for (size_t i = i0; i < i1; ++i) {
+            vsum[i] = static_cast<uint16_t>(top[i] + mid[i] + bot[i]);
+        }
+
+        // Horizontal sliding window + fixed point blend, masked to foreground pixels
+        const float* drow = adjusted_depth.data() + static_cast<size_t>(y) * width;
+        for (int x = x0; x < x1; ++x) {
+            const uint8_t keep = drow[x] > smoothThreshold ? 0xFF : 0x00;
+            const size_t i = static_cast<size_t>(x) * 3;
+            for (size_t c = i; c < i + 3; ++c) {
+                uint32_t sum = static_cast<uint32_t>(vsum[c - 3]) + vsum[c] + vsum[c + 3];
+                uint8_t blended = static_cast<uint8_t>((mid[c] * wt.orig + sum * wt.mean) >> 16);
+                result[c] = static_cast<uint8_t>((blended & keep) | (mid[c] & ~keep));
             }
         }
     }
-};
\ No newline at end of file
+};
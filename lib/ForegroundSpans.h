@@ -0,0 +1,35 @@
+// written by Paul Baxter
+#pragma once
+#include <vector>
+#include <cstddef>
+
+// Per-row runs of covered (foreground) pixels of a depth map.
+// Stored CSR style: spans of row y are spans[rowStart[y] .. rowStart[y + 1]).
+struct ForegroundSpans {
+    struct Span {
+        int x0;     // first covered pixel
+        int x1;     // one past the last covered pixel
+    };
+
+    int width = 0;
+    int height = 0;
+    float background = 0.0f;    // depth value of every pixel outside the spans
+    std::vector<int> rowStart;
+    std::vector<Span> spans;
+
+    void reset(int w, int h, float bg)
+    {
+        width = w;
+        height = h;
+        background = bg;
+        rowStart.assign(static_cast<size_t>(h) + 1, 0);
+        spans.clear();
+    }
+
+    // Call once per row, in order, after that row's spans were pushed
+    void endRow(int y) { rowStart[static_cast<size_t>(y) + 1] = static_cast<int>(spans.size()); }
+
+    const Span* rowBegin(int y) const { return spans.data() + rowStart[y]; }
+    const Span* rowEnd(int y) const { return spans.data() + rowStart[static_cast<size_t>(y) + 1]; }
+    bool valid() const { return height > 0 && rowStart.size() == static_cast<size_t>(height) + 1; }
+};
@@ -0,0 +1,107 @@
+// written by Paul Baxter
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include "Parallel.h"
+#include "stl.h"
+
+/// <summary>
+/// Shared-vertex triangle mesh: xyz positions plus 3 indices per triangle.
+/// Keeps the topology of indexed sources (OBJ) so smoothing needs no welding;
+/// the triangle soup the rasterizer uses is only built by toSoup.
+/// With no indices the positions are a soup themselves (3 per triangle).
+/// </summary>
+struct IndexedMesh {
+    std::vector<float> positions;       // xyz per vertex
+    std::vector<uint32_t> indices;      // 3 per triangle
+
+    size_t vertexCount() const { return positions.size() / 3; }
+    size_t triangleCount() const { return isSoup() ? vertexCount() / 3 : indices.size() / 3; }
+    bool isSoup() const { return indices.empty(); }
+
+    // Same mapping stl::normalizeAndCenter gives the expanded soup; it is fixed by
+    // the bounds of the referenced vertices (see normalization).
+    void normalizeAndCenter()
+    {
+        if (triangleCount() == 0) return;
+
+        float lo[3] = { INF, INF, INF };
+        float hi[3] = { -INF, -INF, -INF };
+        auto include = [&](size_t i)
+            {
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = std::min(lo[a], positions[i * 3 + a]);
+                    hi[a] = std::max(hi[a], positions[i * 3 + a]);
+                }
+            };
+        if (isSoup()) {
+            for (size_t i = 0; i < vertexCount(); ++i) include(i);
+        }
+        else {
+            for (uint32_t i : indices) include(i);
+        }
+
+        float scale[3], offset[3];
+        normalization(lo, hi, scale, offset);
+
+        const int n = static_cast<int>(vertexCount());
+        Parallel::forRange(0, n, [&](int i0, int i1)
+            {
+                for (int i = i0; i < i1; ++i) {
+                    for (int a = 0; a < 3; ++a) positions[i * 3 + a] = positions[i * 3 + a] * scale[a] + offset[a];
+                }
+            }, 1 << 14);
+    }
+
+    // The per axis map (x * scale + offset) stl::normalizeAndCenter applies to a
+    // mesh with bounds [lo, hi], read back from a probe of the two bound corners
+    static void normalization(const float lo[3], const float hi[3], float scale[3], float offset[3])
+    {
+        stl probe;
+        probe.m_vectors = { lo[0], lo[1], lo[2], hi[0], hi[1], hi[2], lo[0], lo[1], lo[2],
+                            hi[0], hi[1], hi[2], lo[0], lo[1], lo[2], hi[0], hi[1], hi[2] };
+        probe.m_num_triangles = 2;
+        probe.normalizeAndCenter();
+
+        for (int a = 0; a < 3; ++a) {
+            const float nlo = probe.m_vectors[a], nhi = probe.m_vectors[3 + a];
+            scale[a] = hi[a] > lo[a] ? (nhi - nlo) / (hi[a] - lo[a]) : 1.0f;
+            offset[a] = nlo - lo[a] * scale[a];
+        }
+    }
+
+    // Expand into an stl triangle soup (9 floats per triangle)
+    void toSoup(stl& mesh) const
+    {
+        toSoup(positions.data(), vertexCount(), indices.data(), indices.size(), mesh);
+    }
+
+    // The same for geometry held elsewhere (a mapped cache); indexCount == 0 is a soup
+    static void toSoup(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount, stl& mesh)
+    {
+        const size_t nt = indexCount == 0 ? vertexCount / 3 : indexCount / 3;
+        mesh.m_num_triangles = static_cast<uint32_t>(nt);
+        if (indexCount == 0) {
+            mesh.m_vectors.assign(positions, positions + nt * 9);
+            return;
+        }
+        mesh.m_vectors.resize(nt * 9);
+        Parallel::forRange(0, static_cast<int>(nt), [&](int t0, int t1)
+            {
+                for (int t = t0; t < t1; ++t) {
+                    for (int k = 0; k < 3; ++k) {
+                        std::memcpy(&mesh.m_vectors[static_cast<size_t>(t) * 9 + k * 3],
+                            &positions[static_cast<size_t>(indices[t * 3 + k]) * 3], 3 * sizeof(float));
+                    }
+                }
+            }, 1 << 14);
+    }
+
+private:
+    static constexpr float INF = std::numeric_limits<float>::infinity();
+};
@@ -1,24 +1,25 @@
 ﻿// written by Paul Baxter
 #pragma once
 #include <vector>
-#include <unordered_map>  
-#include <unordered_set>  
+#include <array>
 #include <algorithm>  
 #include <cstdint>  
 #include <cmath>  
 
 #include "vec3.h"
+#include "Parallel.h"
+#include "RadixSort.h"
 
-// Triangles as indices into V  
-using Tri = glm::vec3;
+// Triangles as indices into V, kept integral so large meshes keep exact ids
+struct Tri {
+    uint32_t x = 0, y = 0, z = 0;
 
-// -------- Utilities --------  
+    Tri() = default;
+    Tri(uint32_t a, uint32_t b, uint32_t c) : x(a), y(b), z(c) {}
+    uint32_t operator[](int k) const { return k == 0 ? x : (k == 1 ? y : z); }
+};
 
-static inline uint64_t edgeKey(uint32_t a, uint32_t b)
-{
-    if (a > b) std::swap(a, b);
-    return (uint64_t(a) << 32) | uint64_t(b);
-}
+// -------- Utilities --------  
 
 static inline float cotangent(const glm::vec3& u, const glm::vec3& v)
 {
@@ -28,102 +29,157 @@ static inline float cotangent(const glm::vec3& u, const glm::vec3& v)
     return glm::dot(u, v) / denom;
 }
 
-// Compute boundary vertices (edges incident to only one face)  
-static void computeBoundaryVertices(
-    const std::vector<Tri>& F, int nVerts, std::vector<char>& isBoundary)
+// Vertex adjacency in compressed sparse row form: the neighbours of vertex i are
+// col[rowStart[i] .. rowStart[i + 1]), sorted by index. weight runs parallel to
+// col and holds the (clamped) cotangent weights once buildCotanWeights has run.
+struct MeshAdjacency {
+    std::vector<uint32_t> rowStart;
+    std::vector<uint32_t> col;
+    std::vector<float> weight;
+    std::vector<uint8_t> boundary;      // vertex lies on an edge used by a single face
+
+    // Per entry: range of half-edges (into halfEdgeFace) that produced it
+    std::vector<uint32_t> edgeStart;
+    std::vector<uint32_t> halfEdgeFace; // face * 3 + corner opposite the edge
+
+    int vertexCount() const { return rowStart.empty() ? 0 : static_cast<int>(rowStart.size()) - 1; }
+    uint32_t degree(int i) const { return rowStart[i + 1] - rowStart[i]; }
+};
+
+// Build the CSR adjacency and boundary flags by sorting the 6 directed
+// half-edges of every face on (from, to). Duplicate keys are one neighbour entry;
+// an undirected edge seen once is a boundary edge.
+static void buildAdjacency(const std::vector<Tri>& F, int nVerts, MeshAdjacency& adj)
 {
-    std::unordered_map<uint64_t, int> edgeCount;
-    edgeCount.reserve(F.size() * 3);
-
-    for (const auto& t : F) {
-        int i0 = t.x, i1 = t.y, i2 = t.z;
-        edgeCount[edgeKey(i0, i1)]++;
-        edgeCount[edgeKey(i1, i2)]++;
-        edgeCount[edgeKey(i2, i0)]++;
-    }
-    isBoundary.assign(nVerts, 0);
-    for (const auto& kv : edgeCount) {
-        if (kv.second == 1) {
-            uint64_t k = kv.first;
-            int a = int(k >> 32);
-            int b = int(k & 0xffffffffu);
-            isBoundary[a] = 1;
-            isBoundary[b] = 1;
-        }
-    }
-}
+    const size_t nHalf = F.size() * 6;
+    int bits = 1;
+    while ((uint64_t(1) << bits) < uint64_t(std::max(nVerts, 2))) ++bits;
 
-// Build uniform neighbor lists (each neighbor weight = 1)  
-static void buildUniformNeighbors(
-    const std::vector<Tri>& F, int nVerts,
-    std::vector<std::vector<int>>& nbrs)
-{
-    nbrs.assign(nVerts, {});
-    auto addPair = [&](int a, int b)
+    std::vector<uint64_t> keys(nHalf);
+    std::vector<uint32_t> faceCorner(nHalf);
+    Parallel::forRange(0, static_cast<int>(F.size()), [&](int f0, int f1)
         {
-            auto& v = nbrs[a];
-            if (std::find(v.begin(), v.end(), b) == v.end()) v.push_back(b);
-        };
-
-    for (const auto& t : F) {
-        int i0 = t.x, i1 = t.y, i2 = t.z;
-        addPair(i0, i1); addPair(i1, i0);
-        addPair(i1, i2); addPair(i2, i1);
-        addPair(i2, i0); addPair(i0, i2);
+            for (int f = f0; f < f1; ++f) {
+                const uint64_t i[3] = { uint64_t(F[f].x), uint64_t(F[f].y), uint64_t(F[f].z) };
+                for (int k = 0; k < 3; ++k) {
+                    // Edge opposite corner k runs between the other two corners
+                    uint64_t a = i[(k + 1) % 3], b = i[(k + 2) % 3];
+                    size_t h = static_cast<size_t>(f) * 6 + k * 2;
+                    keys[h] = (a << bits) | b;
+                    keys[h + 1] = (b << bits) | a;
+                    faceCorner[h] = faceCorner[h + 1] = static_cast<uint32_t>(f * 3 + k);
+                }
+            }
+        }, 4096);
+
+    RadixSort::sortPairs(keys, faceCorner, 2 * bits);
+
+    const uint64_t mask = (uint64_t(1) << bits) - 1;
+    adj.rowStart.assign(static_cast<size_t>(nVerts) + 1, 0);
+    adj.col.clear();
+    adj.edgeStart.clear();
+    adj.boundary.assign(nVerts, 0);
+    adj.col.reserve(nHalf / 2);
+    adj.edgeStart.reserve(nHalf / 2 + 1);
+
+    for (size_t h = 0; h < nHalf;) {
+        size_t e = h + 1;
+        while (e < nHalf && keys[e] == keys[h]) ++e;
+
+        uint32_t from = static_cast<uint32_t>(keys[h] >> bits);
+        uint32_t to = static_cast<uint32_t>(keys[h] & mask);
+        adj.col.push_back(to);
+        adj.edgeStart.push_back(static_cast<uint32_t>(h));
+        ++adj.rowStart[from + 1];
+        if (e - h == 1) {
+            adj.boundary[from] = 1;
+            adj.boundary[to] = 1;
+        }
+        h = e;
     }
+    adj.edgeStart.push_back(static_cast<uint32_t>(nHalf));
+    for (int i = 0; i < nVerts; ++i) adj.rowStart[i + 1] += adj.rowStart[i];
+
+    adj.halfEdgeFace = std::move(faceCorner);
+    adj.weight.clear();
 }
 
-// Build cotangent weights per edge and neighbor lists  
+// Fill adj.weight with cotangent weights: each entry sums 0.5 * cot of the
+// angle opposite its edge over the faces sharing it.
 // We clamp negative weights to zero by default (robustness).  
 static void buildCotanWeights(
     const std::vector<glm::vec3>& V,
     const std::vector<Tri>& F,
-    std::vector<std::vector<std::pair<int, float>>>& nbrsW,  // (neighbor, weight)  
-    std::vector<std::vector<int>>& nbrsIdx,                  // neighbor indices (for fallback)  
+    MeshAdjacency& adj,
     bool clampNegative = true)
 {
-    const int n = (int)V.size();
-    std::vector<std::unordered_map<int, float>> W(n);
-    W.shrink_to_fit();
-
-    // Accumulate per-triangle contributions  
-    for (const auto& t : F) {
-        int i0 = t.x, i1 = t.y, i2 = t.z;
-        const glm::vec3& v0 = V[i0];
-        const glm::vec3& v1 = V[i1];
-        const glm::vec3& v2 = V[i2];
-
-        float c0 = 0.5f * cotangent(v1 - v0, v2 - v0); // opposite edge (i1,i2)  
-        float c1 = 0.5f * cotangent(v2 - v1, v0 - v1); // opposite edge (i2,i0)  
-        float c2 = 0.5f * cotangent(v0 - v2, v1 - v2); // opposite edge (i0,i1)  
-
-        if (!std::isfinite(c0)) c0 = 0.0f;
-        if (!std::isfinite(c1)) c1 = 0.0f;
-        if (!std::isfinite(c2)) c2 = 0.0f;
-
-        W[i1][i2] += c0; W[i2][i1] += c0;
-        W[i2][i0] += c1; W[i0][i2] += c1;
-        W[i0][i1] += c2; W[i1][i0] += c2;
-    }
+    // Per face corner cotangents, contiguous
+    std::vector<float> cot(F.size() * 3);
+    Parallel::forRange(0, static_cast<int>(F.size()), [&](int f0, int f1)
+        {
+            for (int f = f0; f < f1; ++f) {
+                const glm::vec3& v0 = V[F[f].x];
+                const glm::vec3& v1 = V[F[f].y];
+                const glm::vec3& v2 = V[F[f].z];
+
+                float c0 = 0.5f * cotangent(v1 - v0, v2 - v0); // opposite edge (i1,i2)  
+                float c1 = 0.5f * cotangent(v2 - v1, v0 - v1); // opposite edge (i2,i0)  
+                float c2 = 0.5f * cotangent(v0 - v2, v1 - v2); // opposite edge (i0,i1)  
+
+                cot[f * 3 + 0] = std::isfinite(c0) ? c0 : 0.0f;
+                cot[f * 3 + 1] = std::isfinite(c1) ? c1 : 0.0f;
+                cot[f * 3 + 2] = std::isfinite(c2) ? c2 : 0.0f;
+            }
+        }, 4096);
+
+    const size_t nnz = adj.col.size();
+    adj.weight.resize(nnz);
+    Parallel::forRange(0, static_cast<int>(nnz), [&](int e0, int e1)
+        {
+            for (int e = e0; e < e1; ++e) {
+                float w = 0.0f;
+                for (uint32_t h = adj.edgeStart[e]; h < adj.edgeStart[e + 1]; ++h) w += cot[adj.halfEdgeFace[h]];
+                if (clampNegative && w < 0.0f) w = 0.0f;
+                adj.weight[e] = w;
+            }
+        }, 4096);
+}
 
-    nbrsW.assign(n, {});
-    nbrsIdx.assign(n, {});
-    for (int i = 0; i < n; ++i) {
-        float sum = 0.0f;
-        nbrsW[i].reserve(W[i].size());
-        nbrsIdx[i].reserve(W[i].size());
-        for (const auto& kv : W[i]) {
-            int j = kv.first;
-            float w = kv.second;
-            if (clampNegative && w < 0.0f) w = 0.0f;
-            nbrsW[i].emplace_back(j, w);
-            nbrsIdx[i].push_back(j);
-            sum += w;
+// Structure-of-arrays positions for the parallel smoothers  
+struct PositionsSoA {
+    std::vector<float> x, y, z;
+
+    void assign(const std::vector<glm::vec3>& V)
+    {
+        x.resize(V.size());
+        y.resize(V.size());
+        z.resize(V.size());
+        for (size_t i = 0; i < V.size(); ++i) {
+            x[i] = V[i].x;
+            y[i] = V[i].y;
+            z[i] = V[i].z;
         }
-        // If a vertex has no weighted neighbors (e.g., all clamped), it's fine;  
-        // we'll fall back to uniform averaging using nbrsIdx.  
     }
-}
+
+    void store(std::vector<glm::vec3>& V) const
+    {
+        V.resize(x.size());
+        for (size_t i = 0; i < x.size(); ++i) V[i] = glm::vec3(x[i], y[i], z[i]);
+    }
+
+    void resize(size_t n)
+    {
+        x.assign(n, 0.0f);
+        y.assign(n, 0.0f);
+        z.assign(n, 0.0f);
+    }
+
+    std::vector<float>& axis(int a) { return a == 0 ? x : (a == 1 ? y : z); }
+    const std::vector<float>& axis(int a) const { return a == 0 ? x : (a == 1 ? y : z); }
+};
+
+// Vertices per parallel block; each Jacobi pass only reads the previous positions
+static constexpr int kSmoothBlock = 2048;
 
 // -------- Smoothers --------  
 
@@ -140,31 +196,51 @@ void uniformSmooth(
     const int n = (int)V.size();
     if (n == 0 || F.empty() || iterations <= 0 || alpha <= 0.0f) return;
 
-    std::vector<std::vector<int>> nbrs;
-    buildUniformNeighbors(F, n, nbrs);
-
-    std::vector<char> isBoundary;
-    computeBoundaryVertices(F, n, isBoundary);
+    MeshAdjacency adj;
+    buildAdjacency(F, n, adj);
 
-    const std::vector<glm::vec3> Vfixed = V; // original positions for boundary pin
+    PositionsSoA X, Xnew;
+    X.assign(V);
+    Xnew = X;
+    const PositionsSoA Xfixed = X; // original positions for boundary pin
 
-    std::vector<glm::vec3> Vnew(n);
     for (int it = 0; it < iterations; ++it) {
-        for (int i = 0; i < n; ++i) {
-            if (fixBoundary && isBoundary[i]) {
-                Vnew[i] = Vfixed[i];
-                continue;
-            }
-            const auto& N = nbrs[i];
-            if (N.empty()) { Vnew[i] = V[i]; continue; }
-
-            glm::vec3 avg(0.0f, 0.0f, 0.0f);
-            for (int j : N) avg = avg + V[j];
-            avg = avg / float(N.size());
-            Vnew[i] = (1.0f - alpha) * V[i] + alpha * avg;
-        }
-        V.swap(Vnew);
+        Parallel::forRange(0, n, [&](int i0, int i1)
+            {
+                const float* px = X.x.data();
+                const float* py = X.y.data();
+                const float* pz = X.z.data();
+                for (int i = i0; i < i1; ++i) {
+                    if (fixBoundary && adj.boundary[i]) {
+                        Xnew.x[i] = Xfixed.x[i];
+                        Xnew.y[i] = Xfixed.y[i];
+                        Xnew.z[i] = Xfixed.z[i];
+                        continue;
+                    }
+                    const uint32_t e0 = adj.rowStart[i], e1 = adj.rowStart[i + 1];
+                    if (e0 == e1) {
+                        Xnew.x[i] = px[i];
+                        Xnew.y[i] = py[i];
+                        Xnew.z[i] = pz[i];
+                        continue;
+                    }
+
+                    float ax = 0.0f, ay = 0.0f, az = 0.0f;
+                    for (uint32_t e = e0; e < e1; ++e) {
+                        const uint32_t j = adj.col[e];
+                        ax += px[j];
+                        ay += py[j];
+                        az += pz[j];
+                    }
+                    const float cnt = float(e1 - e0);
+                    Xnew.x[i] = (1.0f - alpha) * px[i] + alpha * (ax / cnt);
+                    Xnew.y[i] = (1.0f - alpha) * py[i] + alpha * (ay / cnt);
+                    Xnew.z[i] = (1.0f - alpha) * pz[i] + alpha * (az / cnt);
+                }
+            }, kSmoothBlock);
+        std::swap(X, Xnew);
     }
+    X.store(V);
 }
 
 // 2) Taubin λ/μ smoothing with cotangent weights (explicit, non-shrinking).  
@@ -182,59 +258,256 @@ void taubinCotanSmooth(
     const int n = (int)V.size();
     if (n == 0 || F.empty() || iterations <= 0) return;
 
-    // Build cotan weights once (frozen) + neighbor indices for fallback  
-    std::vector<std::vector<std::pair<int, float>>> nbrsW;
-    std::vector<std::vector<int>> nbrsIdx;
-    buildCotanWeights(V, F, nbrsW, nbrsIdx, clampNegativeWeights);
+    // Build cotan weights once (frozen); uniform fallback uses the same rows  
+    MeshAdjacency adj;
+    buildAdjacency(F, n, adj);
+    buildCotanWeights(V, F, adj, clampNegativeWeights);
 
-    std::vector<char> isBoundary;
-    computeBoundaryVertices(F, n, isBoundary);
+    PositionsSoA X, Xtmp;
+    X.assign(V);
+    Xtmp = X;
+    const PositionsSoA Xfixed = X; // keep exact boundary pin
 
-    const std::vector<glm::vec3> Vfixed = V; // keep exact boundary pin
+    // One Jacobi pass; every vertex is independent, so blocks run in parallel
+    // and the result matches a serial pass exactly
+    auto smoothPass = [&](const PositionsSoA& Xin, PositionsSoA& Xout, float step)
+        {
+            Parallel::forRange(0, n, [&](int i0, int i1)
+                {
+                    const float* px = Xin.x.data();
+                    const float* py = Xin.y.data();
+                    const float* pz = Xin.z.data();
+                    const uint32_t* col = adj.col.data();
+                    const float* weight = adj.weight.data();
+
+                    for (int i = i0; i < i1; ++i) {
+                        if (fixBoundary && adj.boundary[i]) {
+                            Xout.x[i] = Xfixed.x[i];
+                            Xout.y[i] = Xfixed.y[i];
+                            Xout.z[i] = Xfixed.z[i];
+                            continue;
+                        }
+                        const uint32_t e0 = adj.rowStart[i], e1 = adj.rowStart[i + 1];
+
+                        // Weighted mean by cotan weights; non-positive weights add exact zeros  
+                        float sx = 0.0f, sy = 0.0f, sz = 0.0f, sumW = 0.0f;
+                        for (uint32_t e = e0; e < e1; ++e) {
+                            const float w = weight[e] > 0.0f ? weight[e] : 0.0f;
+                            const uint32_t j = col[e];
+                            sx += w * px[j];
+                            sy += w * py[j];
+                            sz += w * pz[j];
+                            sumW += w;
+                        }
+
+                        float mx, my, mz;
+                        if (sumW > 1e-12f) {
+                            mx = sx / sumW;
+                            my = sy / sumW;
+                            mz = sz / sumW;
+                        }
+                        else {
+                            // Fallback: uniform mean  
+                            if (e0 == e1) {
+                                Xout.x[i] = px[i];
+                                Xout.y[i] = py[i];
+                                Xout.z[i] = pz[i];
+                                continue;
+                            }
+                            float ax = 0.0f, ay = 0.0f, az = 0.0f;
+                            for (uint32_t e = e0; e < e1; ++e) {
+                                ax += px[col[e]];
+                                ay += py[col[e]];
+                                az += pz[col[e]];
+                            }
+                            const float cnt = float(e1 - e0);
+                            mx = ax / cnt;
+                            my = ay / cnt;
+                            mz = az / cnt;
+                        }
+
+                        Xout.x[i] = px[i] + step * (mx - px[i]);
+                        Xout.y[i] = py[i] + step * (my - py[i]);
+                        Xout.z[i] = pz[i] + step * (mz - pz[i]);
+                    }
+                }, kSmoothBlock);
+        };
 
-    std::vector<glm::vec3> Vtmp(n), Vnew(n);
+    for (int it = 0; it < iterations; ++it) {
+        // First pass (smoothing)  
+        smoothPass(X, Xtmp, lambda);
+        // Second pass (inflation to counter shrinkage)  
+        smoothPass(Xtmp, X, mu);
+    }
+    X.store(V);
+}
 
-    auto smoothPass = [&](const std::vector<glm::vec3>& Xin,
-            std::vector<glm::vec3>& Xout, float step)
+// 3) Implicit (backward Euler) cotangent smoothing.  
+// Solves (I + lambda L) X = X0, L = D - W the clamped cotan Laplacian, with
+// Jacobi preconditioned conjugate gradients; x, y and z are three solves that
+// share every sparse product. Unconditionally stable, so one solve with
+// lambda ~1-10 replaces hundreds of explicit passes. Shrinks like a lambda
+// only step. Boundary vertices stay at X0 (Dirichlet) when fixBoundary is set.
+// Returns the number of CG iterations used.  
+int implicitSmooth(
+    std::vector<glm::vec3>& V,
+    const std::vector<Tri>& F,
+    float lambda = 1.0f,
+    int maxIterations = 200,
+    float tolerance = 1e-5f,
+    bool fixBoundary = true)
+{
+    const int n = (int)V.size();
+    if (n == 0 || F.empty() || lambda <= 0.0f || maxIterations <= 0) return 0;
+
+    MeshAdjacency adj;
+    buildAdjacency(F, n, adj);
+    buildCotanWeights(V, F, adj, true);
+
+    PositionsSoA X, R, Z, P, Q;
+    X.assign(V);
+    R.resize(n);
+    Z.resize(n);
+    P.resize(n);
+    Q.resize(n);
+
+    // Reductions are summed per fixed chunk, then in chunk order, so the
+    // result does not depend on the thread count
+    const int chunks = (n + kSmoothBlock - 1) / kSmoothBlock;
+    std::vector<std::array<double, 6>> partial(chunks);
+    auto forChunks = [&](auto&& fn)
         {
-            for (int i = 0; i < n; ++i) {
-                if (fixBoundary && isBoundary[i]) {
-                    Xout[i] = Vfixed[i];
-                    continue;
-                }
-                const auto& Wlist = nbrsW[i];
-                const auto& Nidx = nbrsIdx[i];
-
-                // Weighted mean by cotan weights  
-                glm::vec3 weightedSum(0.0f);
-                float sumW = 0.0f;
-                for (auto [j, w] : Wlist) {
-                    if (w <= 0.0f) continue;
-                    weightedSum = weightedSum + w * Xin[j];
-                    sumW += w;
+            Parallel::forRange(0, chunks, [&](int c0, int c1)
+                {
+                    for (int c = c0; c < c1; ++c) {
+                        std::array<double, 6> acc{};
+                        fn(c * kSmoothBlock, std::min(n, (c + 1) * kSmoothBlock), acc);
+                        partial[c] = acc;
+                    }
+                });
+            std::array<double, 6> sum{};
+            for (const auto& p : partial) {
+                for (int k = 0; k < 6; ++k) sum[k] += p[k];
+            }
+            return sum;
+        };
+
+    auto isFixed = [&](int i) { return fixBoundary && adj.boundary[i]; };
+
+    // Jacobi preconditioner: the diagonal 1 + lambda * sum(w)
+    std::vector<float> invDiag(n);
+    Parallel::forRange(0, n, [&](int i0, int i1)
+        {
+            for (int i = i0; i < i1; ++i) {
+                float d = 0.0f;
+                for (uint32_t e = adj.rowStart[i]; e < adj.rowStart[i + 1]; ++e) d += adj.weight[e];
+                invDiag[i] = 1.0f / (1.0f + lambda * d);
+            }
+        }, kSmoothBlock);
+
+    // r = b - A x0 = -lambda L x0 on free vertices; fixed rows are solved already.
+    // Fixed entries of r, z and p stay zero, which eliminates those columns.
+    auto init = forChunks([&](int i0, int i1, std::array<double, 6>& acc)
+        {
+            for (int i = i0; i < i1; ++i) {
+                if (isFixed(i)) continue;
+                for (int a = 0; a < 3; ++a) {
+                    const float* px = X.axis(a).data();
+                    float lx = 0.0f;
+                    for (uint32_t e = adj.rowStart[i]; e < adj.rowStart[i + 1]; ++e) {
+                        lx += adj.weight[e] * (px[i] - px[adj.col[e]]);
+                    }
+                    const float r = -lambda * lx;
+                    const float z = r * invDiag[i];
+                    R.axis(a)[i] = r;
+                    Z.axis(a)[i] = z;
+                    P.axis(a)[i] = z;
+                    acc[a] += double(r) * z;
+                    acc[a + 3] += double(px[i]) * px[i];
                 }
+            }
+        });
+
+    double rz[3], stop[3];
+    bool done[3];
+    for (int a = 0; a < 3; ++a) {
+        rz[a] = init[a];
+        stop[a] = double(tolerance) * tolerance * std::max(init[a + 3], 1e-30);
+        done[a] = rz[a] <= 0.0;
+    }
 
-                glm::vec3 mean;
-                if (sumW > 1e-12f) {
-                    mean = weightedSum / sumW;
+    int it = 0;
+    while (it < maxIterations && !(done[0] && done[1] && done[2])) {
+        ++it;
+
+        // q = A p, and p.q
+        auto pq = forChunks([&](int i0, int i1, std::array<double, 6>& acc)
+            {
+                for (int i = i0; i < i1; ++i) {
+                    if (isFixed(i)) continue;
+                    for (int a = 0; a < 3; ++a) {
+                        if (done[a]) continue;
+                        const float* pp = P.axis(a).data();
+                        float wp = 0.0f, sumW = 0.0f;
+                        for (uint32_t e = adj.rowStart[i]; e < adj.rowStart[i + 1]; ++e) {
+                            wp += adj.weight[e] * pp[adj.col[e]];
+                            sumW += adj.weight[e];
+                        }
+                        const float q = (1.0f + lambda * sumW) * pp[i] - lambda * wp;
+                        Q.axis(a)[i] = q;
+                        acc[a] += double(pp[i]) * q;
+                    }
                 }
-                else {
-                    // Fallback: uniform mean  
-                    if (Nidx.empty()) { Xout[i] = Xin[i]; continue; }
-                    glm::vec3 avg(0.0f);
-                    for (int j : Nidx) avg = avg + Xin[j];
-                    mean = avg / float(Nidx.size());
+            });
+
+        float alpha[3] = { 0.0f, 0.0f, 0.0f };
+        for (int a = 0; a < 3; ++a) {
+            if (done[a]) continue;
+            if (!(pq[a] > 0.0)) done[a] = true;
+            else alpha[a] = static_cast<float>(rz[a] / pq[a]);
+        }
+
+        // x += alpha p, r -= alpha q, z = M^-1 r, with r.r and r.z
+        auto rr = forChunks([&](int i0, int i1, std::array<double, 6>& acc)
+            {
+                for (int i = i0; i < i1; ++i) {
+                    if (isFixed(i)) continue;
+                    for (int a = 0; a < 3; ++a) {
+                        if (done[a]) continue;
+                        X.axis(a)[i] += alpha[a] * P.axis(a)[i];
+                        const float r = R.axis(a)[i] - alpha[a] * Q.axis(a)[i];
+                        const float z = r * invDiag[i];
+                        R.axis(a)[i] = r;
+                        Z.axis(a)[i] = z;
+                        acc[a] += double(r) * r;
+                        acc[a + 3] += double(r) * z;
+                    }
                 }
+            });
 
-                Xout[i] = Xin[i] + step * (mean - Xin[i]);
+        float beta[3] = { 0.0f, 0.0f, 0.0f };
+        for (int a = 0; a < 3; ++a) {
+            if (done[a]) continue;
+            if (rr[a] <= stop[a]) {
+                done[a] = true;
+                continue;
             }
-        };
+            beta[a] = static_cast<float>(rr[a + 3] / rz[a]);
+            rz[a] = rr[a + 3];
+        }
 
-    for (int it = 0; it < iterations; ++it) {
-        // First pass (smoothing)  
-        smoothPass(V, Vtmp, lambda);
-        // Second pass (inflation to counter shrinkage)  
-        smoothPass(Vtmp, Vnew, mu);
-        V.swap(Vnew);
+        // p = z + beta p
+        Parallel::forRange(0, n, [&](int i0, int i1)
+            {
+                for (int a = 0; a < 3; ++a) {
+                    if (done[a]) continue;
+                    float* pp = P.axis(a).data();
+                    const float* pz = Z.axis(a).data();
+                    for (int i = i0; i < i1; ++i) pp[i] = pz[i] + beta[a] * pp[i];
+                }
+            }, kSmoothBlock);
     }
+
+    X.store(V);
+    return it;
 }
@@ -0,0 +1,218 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#include "IndexedMesh.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+/// <summary>
+/// .memesh: the normalized geometry of a source model, stored next to it as
+/// "<source>.memesh" and memory mapped on later loads instead of reparsing.
+///
+/// Layout (native byte order): Header, positions (float xyz), indices (uint32).
+/// indexCount == 0 stores a triangle soup. The header holds the source stamp
+/// (size, modification time and a hash of its first and last MiB) and a
+/// checksum of the positions and indices; a mismatch in any of them rejects
+/// the file.
+/// </summary>
+class MemeshFile {
+public:
+    static constexpr uint32_t kVersion = 2;
+
+    /// <summary>
+    /// A loaded cache used in place: positions and indices point into the
+    /// mapping, which the view keeps open for as long as it lives. Move-only.
+    /// </summary>
+    struct View {
+        MappedFile file;
+        const float* positions = nullptr;     // xyz per vertex
+        const uint32_t* indices = nullptr;    // 3 per triangle, none for a soup
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t checksum;
+    };
+    static_assert(sizeof(Header) == 64, "memesh header must stay packed");
+
+    static std::string pathFor(const std::string& source) { return source + ".memesh"; }
+
+    /// <summary>
+    /// Map the cache of source into view. Returns false if there is none, or it
+    /// is stale (source changed), truncated or corrupt.
+    /// </summary>
+    static bool load(const std::string& source, View& view)
+    {
+        Header stamp{};
+        if (!sourceStamp(source, stamp)) return false;
+
+        MappedFile file(pathFor(source));
+        if (!file.isOpen() || file.size() < sizeof(Header)) return false;
+
+        Header h;
+        std::memcpy(&h, file.data(), sizeof(Header));
+        if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion) return false;
+        if (h.sourceSize != stamp.sourceSize || h.sourceTime != stamp.sourceTime || h.sourceHash != stamp.sourceHash) return false;
+        if (h.vertexCount > file.size() / 12 || h.indexCount > file.size() / 4) return false;
+
+        const size_t posBytes = static_cast<size_t>(h.vertexCount) * 3 * sizeof(float);
+        const size_t idxBytes = static_cast<size_t>(h.indexCount) * sizeof(uint32_t);
+        if (file.size() != sizeof(Header) + posBytes + idxBytes) return false;
+        const uint8_t* pos = file.data() + sizeof(Header);
+        const uint8_t* idx = pos + posBytes;
+        if (checksum(pos, posBytes, idx, idxBytes) != h.checksum) return false;
+
+        // The mapping is page aligned and the header a multiple of 8 bytes, so
+        // both arrays are aligned for their element type
+        const uint32_t* indices = reinterpret_cast<const uint32_t*>(idx);
+        const size_t nv = static_cast<size_t>(h.vertexCount);
+        const size_t ni = static_cast<size_t>(h.indexCount);
+        for (size_t i = 0; i < ni; ++i) {
+            if (indices[i] >= nv) return false;
+        }
+
+        view.positions = reinterpret_cast<const float*>(pos);
+        view.indices = ni ? indices : nullptr;
+        view.vertexCount = nv;
+        view.indexCount = ni;
+        view.file = std::move(file);
+        return true;
+    }
+
+    // Copy a loaded cache into mesh, for callers that modify the geometry
+    static void copy(const View& view, IndexedMesh& mesh)
+    {
+        mesh.positions.assign(view.positions, view.positions + view.vertexCount * 3);
+        mesh.indices.assign(view.indices, view.indices + view.indexCount);
+    }
+
+    /// <summary>
+    /// Write mesh as the cache of source. Written to a temporary file and renamed,
+    /// so readers never see a partial cache. Returns false if it cannot be written.
+    /// </summary>
+    static bool save(const std::string& source, const IndexedMesh& mesh)
+    {
+        Header h{};
+        if (!sourceStamp(source, h)) return false;
+
+        std::memcpy(h.magic, kMagic, sizeof(kMagic));
+        h.version = kVersion;
+        h.vertexCount = mesh.vertexCount();
+        h.indexCount = mesh.indices.size();
+
+        const size_t posBytes = static_cast<size_t>(h.vertexCount) * 3 * sizeof(float);
+        const size_t idxBytes = mesh.indices.size() * sizeof(uint32_t);
+        const uint8_t* pos = reinterpret_cast<const uint8_t*>(mesh.positions.data());
+        const uint8_t* idx = reinterpret_cast<const uint8_t*>(mesh.indices.data());
+        h.checksum = checksum(pos, posBytes, idx, idxBytes);
+
+        const std::string target = pathFor(source);
+        const std::string temp = target + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(pos), static_cast<std::streamsize>(posBytes));
+            out.write(reinterpret_cast<const char*>(idx), static_cast<std::streamsize>(idxBytes));
+            if (!out) {
+                out.close();
+                std::error_code ec;
+                std::filesystem::remove(temp, ec);
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, target, ec);
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr char kMagic[8] = { 'M', 'E', 'M', 'E', 'S', 'H', '\0', '\x1A' };
+    static constexpr size_t kSampleBytes = size_t(1) << 20;
+    static constexpr size_t kChecksumBlock = size_t(1) << 20;
+
+    static uint64_t fnv1a(const uint8_t* data, size_t n, uint64_t h = 0xCBF29CE484222325ull)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            h ^= data[i];
+            h *= 0x100000001B3ull;
+        }
+        return h;
+    }
+
+    // Size, modification time and a hash of the first and last MiB of the source
+    static bool sourceStamp(const std::string& source, Header& h)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(source, ec);
+        if (ec) return false;
+        auto mtime = std::filesystem::last_write_time(source, ec);
+        if (ec) return false;
+
+        MappedFile file(source);
+        if (!file.isOpen()) return false;
+        const size_t head = std::min(file.size(), kSampleBytes);
+        const size_t tail = std::min(file.size() - head, kSampleBytes);
+        uint64_t hash = fnv1a(file.data(), head);
+        hash = fnv1a(file.data() + file.size() - tail, tail, hash);
+
+        h.sourceSize = static_cast<uint64_t>(size);
+        h.sourceTime = static_cast<int64_t>(mtime.time_since_epoch().count());
+        h.sourceHash = hash;
+        return true;
+    }
+
+    // Positions and indices hashed where they are, so saving needs no joined copy
+    static uint64_t checksum(const uint8_t* pos, size_t posBytes, const uint8_t* idx, size_t idxBytes)
+    {
+        return (checksum(pos, posBytes) ^ checksum(idx, idxBytes) * 0x9E3779B97F4A7C15ull) * 0x100000001B3ull;
+    }
+
+    // Per block word hash, blocks in parallel and combined in order
+    static uint64_t checksum(const uint8_t* data, size_t n)
+    {
+        const size_t blocks = (n + kChecksumBlock - 1) / kChecksumBlock;
+        std::vector<uint64_t> partial(blocks);
+        Parallel::forRange(0, static_cast<int>(blocks), [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    const size_t begin = static_cast<size_t>(b) * kChecksumBlock;
+                    const size_t end = std::min(n, begin + kChecksumBlock);
+                    uint64_t h = 0x9E3779B97F4A7C15ull ^ begin;
+                    size_t i = begin;
+                    for (; i + 8 <= end; i += 8) {
+                        uint64_t w;
+                        std::memcpy(&w, data + i, 8);
+                        h = (h ^ w) * 0x100000001B3ull;
+                        h ^= h >> 29;
+                    }
+                    partial[b] = fnv1a(data + i, end - i, h);
+                }
+            });
+        uint64_t h = static_cast<uint64_t>(n);
+        for (uint64_t p : partial) h = (h ^ p) * 0x100000001B3ull;
+        return h;
+    }
+};
@@ -0,0 +1,169 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <filesystem>
+
+#include "stl.h"
+#include "Stats.h"
+
+/// <summary>
+/// Process-wide LRU cache of loaded meshes in model space (normalized, and
+/// smoothed when asked), shared read-only between renders. The model transform
+/// is applied at rasterization, so renders that differ only in rotation, scale,
+/// shear or camera reuse the same entry.
+/// Keyed by canonical path, modification time, file size and a variant string
+/// naming the preprocessing, so an edited file is loaded again.
+/// Thread safe; loading happens outside the lock.
+/// </summary>
+class MeshCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+    };
+
+    using Loader = std::function<std::shared_ptr<const stl>()>;
+
+    static MeshCache& instance()
+    {
+        static MeshCache cache;
+        return cache;
+    }
+
+    /// <summary>
+    /// Return the mesh for path and variant, calling load on a miss.
+    /// Returns nullptr if the file does not exist or load returns nullptr;
+    /// load may also throw, which propagates to the caller.
+    /// </summary>
+    std::shared_ptr<const stl> get(const std::string& path, const std::string& variant, const Loader& load)
+    {
+        std::error_code ec;
+        std::filesystem::path canonical = std::filesystem::canonical(path, ec);
+        if (ec) return nullptr;
+        auto size = std::filesystem::file_size(canonical, ec);
+        if (ec) return nullptr;
+        auto mtime = std::filesystem::last_write_time(canonical, ec);
+        if (ec) return nullptr;
+
+        const std::string file = canonical.string();
+        const std::string version = file + '|' + std::to_string(mtime.time_since_epoch().count()) + '|' + std::to_string(size);
+        const std::string key = version + '|' + variant;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                lru.splice(lru.begin(), lru, it->second);
+                ++stats_.hits;
+                STATS_ADD(CacheHits, 1);
+                return it->second->mesh;
+            }
+            ++stats_.misses;
+            STATS_ADD(CacheMisses, 1);
+        }
+
+        std::shared_ptr<const stl> mesh = load();
+        if (!mesh) return nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(key, file, version, mesh);
+        return mesh;
+    }
+
+    void setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s = stats_;
+        s.entries = lru.size();
+        s.bytes = used;
+        s.budget = budget;
+        return s;
+    }
+
+    static size_t bytesOf(const stl& mesh)
+    {
+        return mesh.m_vectors.size() * sizeof(mesh.m_vectors[0])
+            + mesh.m_rgb_color.size() * sizeof(mesh.m_rgb_color[0]);
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::string file;
+        std::string version;
+        std::shared_ptr<const stl> mesh;
+        size_t bytes = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Entry> lru;       // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t budget = size_t(1) << 30;
+    size_t used = 0;
+    Stats stats_;
+
+    MeshCache() = default;
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    void insert(const std::string& key, const std::string& file, const std::string& version, std::shared_ptr<const stl> mesh)
+    {
+        // Another thread may have loaded the same mesh meanwhile
+        if (index.count(key)) return;
+
+        // Drop entries of older versions of the same file; other variants of
+        // the current version stay
+        for (auto it = lru.begin(); it != lru.end();) {
+            if (it->file == file && it->version != version) {
+                used -= it->bytes;
+                index.erase(it->key);
+                it = lru.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        size_t bytes = bytesOf(*mesh);
+        if (bytes > budget) return;     // too large to keep, caller still gets it
+
+        lru.push_front({ key, file, version, std::move(mesh), bytes });
+        index[key] = lru.begin();
+        used += bytes;
+        evict();
+    }
+
+    void evict()
+    {
+        while (used > budget && !lru.empty()) {
+            used -= lru.back().bytes;
+            index.erase(lru.back().key);
+            lru.pop_back();
+            ++stats_.evictions;
+        }
+    }
+};
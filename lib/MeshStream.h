@@ -0,0 +1,75 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+
+#include "MappedFile.h"
+#include "StlReader.h"
+
+/// <summary>
+/// Binary STL read straight from its mapping in fixed size chunks, so meshes
+/// larger than memory can be processed: only one chunk of triangles is resident
+/// at a time. The mapped pages are file backed and can be dropped by the OS.
+/// </summary>
+class MeshStream {
+public:
+    static constexpr size_t kChunkTriangles = size_t(1) << 16;     // 2.25 MiB of floats
+
+    // Binary STL only; returns false for ASCII or unreadable files
+    bool open(const std::string& path)
+    {
+        view = {};
+        if (!file.open(path)) return false;
+        if (!StlReader::isBinary(file.data(), file.size()) || !StlReader::binaryView(file.data(), file.size(), view)) {
+            file.close();
+            return false;
+        }
+        return true;
+    }
+
+    size_t triangleCount() const { return view.count; }
+
+    /// <summary>
+    /// Visit every triangle in order, one chunk at a time. Each chunk is copied out
+    /// (9 floats per triangle), passed through transform(xyz, vertexCount), then
+    /// handed to fn(xyz, triangleCount).
+    /// </summary>
+    template <typename Transform, typename Fn>
+    void forEachChunk(Transform&& transform, Fn&& fn) const
+    {
+        std::vector<float> chunk(std::min(view.count, kChunkTriangles) * 9);
+        for (size_t first = 0; first < view.count; first += kChunkTriangles) {
+            const size_t n = std::min(kChunkTriangles, view.count - first);
+            view.copy(first, n, chunk.data());
+            transform(chunk.data(), n * 3);
+            fn(static_cast<const float*>(chunk.data()), n);
+        }
+    }
+
+    // Per axis bounds of the untransformed vertices; false if there are none
+    bool bounds(float lo[3], float hi[3]) const
+    {
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = std::numeric_limits<float>::infinity();
+            hi[a] = -std::numeric_limits<float>::infinity();
+        }
+        forEachChunk([](float*, size_t) {}, [&](const float* xyz, size_t n)
+            {
+                for (size_t i = 0; i < n * 3; ++i) {
+                    for (int a = 0; a < 3; ++a) {
+                        lo[a] = std::min(lo[a], xyz[i * 3 + a]);
+                        hi[a] = std::max(hi[a], xyz[i * 3 + a]);
+                    }
+                }
+            });
+        return view.count > 0;
+    }
+
+private:
+    MappedFile file;
+    StlReader::BinaryView view;
+};
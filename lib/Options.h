@@ -55,4 +55,20 @@ public:
     bool occlusion = false;             // enable simple occlusion gate in SIRDS linking
     float occlusion_epsilon = 0.02f;    // depth tolerance for occlusion gate
     bool tile_texture = true;           // true: repeat texture, false: clamp at edges};
+    bool progressive_preview = false;   // GUI: publish 1/4 and 1/2 scale previews, re-render on change
+    bool bilateral_depth = false;       // edge-preserving smoothing of the depth map before SIRDS
+    float bilateral_sigma_spatial = 1.5f;   // pixels at full resolution
+    float bilateral_sigma_range = 0.05f;    // normalized depth units
+    bool fill_holes = false;            // close enclosed gaps in the depth map from the nearest surface
+    float fill_holes_max_radius = 0.0f; // pixels at full resolution, 0 = any enclosed hole
+    bool laplace_implicit = false;      // one implicit (CG) Laplace solve instead of explicit passes
+    float laplace_lambda = 1.0f;        // implicit smoothing step, larger -> smoother
+    bool mesh_cache = false;            // reuse <model>.memesh, written after the first load
+    bool stream_mesh = false;           // binary STL: rasterize from the file chunk by chunk (no Laplace)
+    bool stats = false;                 // collect per-stage timings and counters
+    std::string stats_json = "";        // write the stats summary as JSON here, if set
+    std::string trace_path = "";        // write a Chrome trace_event file here, if set
+    int threads = 0;                    // threads of the shared pool, 0 = one per hardware thread
+
+    bool operator==(const Options&) const = default;
 };
@@ -0,0 +1,25 @@
+// written by Paul Baxter
+#pragma once
+#include <utility>
+
+#include "ThreadPool.h"
+
+class Parallel {
+public:
+    // Number of threads the shared pool splits work across (at least 1)
+    static int threadCount()
+    {
+        return ThreadPool::instance().threadCount();
+    }
+
+    /// <summary>
+    /// Split [begin, end) into contiguous blocks of at least minBlock items and
+    /// call fn(blockBegin, blockEnd) for each block on the shared ThreadPool.
+    /// The calling thread runs a block too and helps until all are done.
+    /// </summary>
+    template <typename F>
+    static void forRange(int begin, int end, F&& fn, int minBlock = 1)
+    {
+        ThreadPool::instance().parallelFor(begin, end, std::forward<F>(fn), minBlock);
+    }
+};
@@ -0,0 +1,146 @@
+// written by Paul Baxter
+#pragma once
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+
+#include "Parallel.h"
+
+class RadixSort {
+public:
+    /// <summary>
+    /// Stable radix sort of (key, value) pairs by the low keyBits bits of key.
+    /// Large inputs are first partitioned on the top kMsdBits (one parallel,
+    /// memory bound scatter), then every partition is small enough to finish
+    /// with an in-cache LSD sort, partitions in parallel. Equal keys keep their
+    /// input order, so the result is deterministic for any thread count.
+    /// Keys should be spread over the top bits; callers with clustered keys can
+    /// sort a bijective mix of the key instead (see mixKey).
+    /// </summary>
+    static void sortPairs(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int keyBits = 64)
+    {
+        if (values.size() != keys.size()) return;
+        sortPairs(keys.data(), values.data(), keys.size(), keyBits);
+    }
+
+    static void sortPairs(uint64_t* keys, uint32_t* values, size_t n, int keyBits = 64)
+    {
+        if (n < 2) return;
+
+        // Scratch is left uninitialized so it is first touched by the parallel passes
+        std::unique_ptr<uint64_t[]> keyTmp(new uint64_t[n]);
+        std::unique_ptr<uint32_t[]> valTmp(new uint32_t[n]);
+
+        if (n < kMsdThreshold || keyBits <= kMsdBits) {
+            if (lsd(keys, values, keyTmp.get(), valTmp.get(), n, keyBits)) {
+                std::memcpy(keys, keyTmp.get(), n * sizeof(uint64_t));
+                std::memcpy(values, valTmp.get(), n * sizeof(uint32_t));
+            }
+            return;
+        }
+
+        // MSD partition: per block histograms, (bucket, block) scan, stable scatter
+        const int shift = keyBits - kMsdBits;
+        const int blocks = std::clamp(static_cast<int>(n / kMinBlock), 1, Parallel::threadCount() * 4);
+        auto blockBegin = [&](int b) { return static_cast<size_t>(static_cast<unsigned long long>(n) * b / blocks); };
+        auto bucketOf = [&](uint64_t k) { return static_cast<size_t>((k >> shift) & (kMsdBuckets - 1)); };
+
+        std::vector<size_t> offsets(static_cast<size_t>(blocks) * kMsdBuckets, 0);
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    size_t* h = offsets.data() + static_cast<size_t>(b) * kMsdBuckets;
+                    for (size_t i = blockBegin(b), e = blockBegin(b + 1); i < e; ++i) ++h[bucketOf(keys[i])];
+                }
+            });
+
+        std::vector<size_t> bucketStart(kMsdBuckets + 1, 0);
+        size_t sum = 0;
+        for (int d = 0; d < kMsdBuckets; ++d) {
+            bucketStart[d] = sum;
+            for (int b = 0; b < blocks; ++b) {
+                size_t& o = offsets[static_cast<size_t>(b) * kMsdBuckets + d];
+                size_t c = o;
+                o = sum;
+                sum += c;
+            }
+        }
+        bucketStart[kMsdBuckets] = sum;
+
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    size_t* o = offsets.data() + static_cast<size_t>(b) * kMsdBuckets;
+                    for (size_t i = blockBegin(b), e = blockBegin(b + 1); i < e; ++i) {
+                        size_t dst = o[bucketOf(keys[i])]++;
+                        keyTmp[dst] = keys[i];
+                        valTmp[dst] = values[i];
+                    }
+                }
+            });
+
+        // Finish each partition on the remaining low bits, results back in keys/values
+        Parallel::forRange(0, kMsdBuckets, [&](int d0, int d1)
+            {
+                for (int d = d0; d < d1; ++d) {
+                    size_t b = bucketStart[d], m = bucketStart[d + 1] - b;
+                    if (m == 0) continue;
+                    bool inKeys = lsd(keyTmp.get() + b, valTmp.get() + b, keys + b, values + b, m, shift);
+                    if (!inKeys) {
+                        std::memcpy(keys + b, keyTmp.get() + b, m * sizeof(uint64_t));
+                        std::memcpy(values + b, valTmp.get() + b, m * sizeof(uint32_t));
+                    }
+                }
+            });
+    }
+
+    // Bijective 64 bit mix (splitmix64 finalizer): equal keys stay equal, clusters spread out
+    static uint64_t mixKey(uint64_t k)
+    {
+        k ^= k >> 30; k *= 0xBF58476D1CE4E5B9ull;
+        k ^= k >> 27; k *= 0x94D049BB133111EBull;
+        k ^= k >> 31;
+        return k;
+    }
+
+private:
+    static constexpr int kDigitBits = 8;
+    static constexpr int kBuckets = 1 << kDigitBits;
+    static constexpr int kMsdBits = 12;
+    static constexpr int kMsdBuckets = 1 << kMsdBits;
+    static constexpr size_t kMsdThreshold = size_t(1) << 16;
+    static constexpr size_t kMinBlock = size_t(1) << 16;
+
+    // Serial stable LSD sort of n pairs on bits [0, keyBits), ping-ponging between
+    // (k, v) and the scratch (kt, vt). Returns true if the result ended in the
+    // scratch buffers. Digits equal for every key are skipped.
+    static bool lsd(uint64_t* k, uint32_t* v, uint64_t* kt, uint32_t* vt, size_t n, int keyBits)
+    {
+        bool inScratch = false;
+        for (int shift = 0; shift < keyBits; shift += kDigitBits) {
+            std::array<size_t, kBuckets> count{};
+            for (size_t i = 0; i < n; ++i) ++count[(k[i] >> shift) & (kBuckets - 1)];
+            if (count[(k[0] >> shift) & (kBuckets - 1)] == n) continue;
+
+            size_t sum = 0;
+            for (auto& c : count) {
+                size_t t = c;
+                c = sum;
+                sum += t;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                size_t dst = count[(k[i] >> shift) & (kBuckets - 1)]++;
+                kt[dst] = k[i];
+                vt[dst] = v[i];
+            }
+            std::swap(k, kt);
+            std::swap(v, vt);
+            inScratch = !inScratch;
+        }
+        return inScratch;
+    }
+};
@@ -8,12 +8,16 @@
 #include <cmath>
 #include <cstdint>
 #include <memory>
+#include <optional>
 
 #include "TextureSampler.h"
 #include "Options.h"
 #include "EdgeSmoother.h"
+#include "ForegroundSpans.h"
 #include "BlueNoise.h"
 #include "SeparationCalibrator.h"
+#include "Parallel.h"
+#include "Stats.h"
 
     class SIRDSGenerator {
     public:
@@ -22,24 +26,30 @@
         };
 
         static void generate(const std::vector<float>& depth, int width, int height,
-            int eye_separation, const std::vector<uint8_t>& texture,
-            int tw, int th, int tchan, std::vector<uint8_t>& out_rgb,
+            int eye_separation, const TextureView& texture, std::vector<uint8_t>& out_rgb,
             float texture_brightness, float texture_contrast,
             float bg_separation, const std::shared_ptr<Options>& opt,
+            const ForegroundSpans* spans = nullptr,
             Method method = Method::UnionFind)
         {
             if (!opt) throw std::runtime_error("SIRDSGenerator::generate: Options is null.");
+            STATS_SCOPE("sirds");
 
             generateUnionFind(depth, width, height, eye_separation, texture,
-                tw, th, tchan, out_rgb, texture_brightness,
-                texture_contrast, bg_separation, *opt);
+                out_rgb, texture_brightness,
+                texture_contrast, bg_separation, *opt, spans);
         }
 
     private:
+        static constexpr int kBandRows = 128;   // rows linked in parallel before their serial color pass
+
         class UnionFind {
         private:
             std::vector<int> parent;
         public:
+            uint64_t finds = 0;     // tallies for Stats
+            uint64_t unions = 0;
+
             UnionFind(int n = 0) { reset(n); }
             void reset(int n)
             {
@@ -48,6 +58,7 @@
             }
             int find(int x)
             {
+                ++finds;
                 int r = x;
                 while (parent[r] != r) r = parent[r];
                 while (parent[x] != x) {
@@ -61,15 +72,17 @@
             {
                 a = find(a);
                 b = find(b);
-                if (a != b) parent[b] = a;
+                if (a != b) {
+                    parent[b] = a;
+                    ++unions;
+                }
             }
         };
 
         static void generateUnionFind(const std::vector<float>& depth, int width, int height,
-            int eye_separation, const std::vector<uint8_t>& texture,
-            int tw, int th, int tchan, std::vector<uint8_t>& out_rgb,
+            int eye_separation, const TextureView& texture, std::vector<uint8_t>& out_rgb,
             float texture_brightness, float texture_contrast,
-            float bg_separation, const Options& options)
+            float bg_separation, const Options& options, const ForegroundSpans* spans)
         {
             std::vector<float> adjusted_depth = adjustDepthRange(depth, bg_separation);
             out_rgb.assign(static_cast<size_t>(width) * height * 3, 0);
@@ -84,33 +97,78 @@
             }
             std::uniform_int_distribution<int> distr(0, 255);
 
-            std::vector<uint8_t> noiseRGB;
-            if (texture.empty()) {
-                noiseRGB = BlueNoise::generateRGB(width, height, static_cast<uint32_t>(options.rng_seed < 0 ? rng() : options.rng_seed));
+            // Texture and noise are looked up lazily, only for root pixels that need them
+            std::unique_ptr<TextureSampler::RowSampler> texSampler;
+            std::unique_ptr<BlueNoise::Sampler> noise;
+            if (!texture.empty()) {
+                texSampler = std::make_unique<TextureSampler::RowSampler>(texture, width, height,
+                    options.tile_texture, texture_brightness, texture_contrast);
+            }
+            else {
+                noise = std::make_unique<BlueNoise::Sampler>(static_cast<uint32_t>(options.rng_seed < 0 ? rng() : options.rng_seed));
             }
 
             float focus_depth = SeparationCalibrator::estimateFocusDepth(adjusted_depth, width, height);
             std::vector<int> separation_map = calculateSeparationMap(adjusted_depth, width, height, eye_separation, options, focus_depth);
 
-            UnionFind uf(width);
+            // Bands of rows: linking and the texture/noise lookup of the roots only
+            // read their own row, so the rows of a band run in parallel; colors then
+            // propagate from the row above, which keeps that pass serial. Only one
+            // band of roots is held at a time.
+            const int bandRows = std::min(height, kBandRows);
+            std::vector<int> roots(static_cast<size_t>(width) * bandRows);
+            std::vector<std::array<uint8_t, 3>> rootColors(static_cast<size_t>(width) * bandRows);
+            const bool batched = texSampler || noise;
+            std::vector<bool> rootHasColor(width);
 
             // Single-row cache; index as x*3
             std::vector<uint8_t> prev_row_colors(static_cast<size_t>(width) * 3, 0);
             bool have_prev = false;
 
-            for (int y = 0; y < height; ++y) {
-                processScanline(y, width, height, adjusted_depth, separation_map, uf,
-                    texture, tw, th, tchan, noiseRGB, out_rgb, prev_row_colors, have_prev, rng, distr,
-                    texture_brightness, texture_contrast, options);
+            for (int band = 0; band < height; band += bandRows) {
+                const int bandEnd = std::min(height, band + bandRows);
+                {
+                    STATS_SCOPE("sirds.link");
+                    Parallel::forRange(band, bandEnd, [&](int y0, int y1)
+                        {
+                            UnionFind uf(width);
+                            // The sampler caches one blended texture row, so each block has its own
+                            std::optional<TextureSampler::RowSampler> sampler;
+                            if (texSampler) sampler.emplace(*texSampler);
+                            for (int y = y0; y < y1; ++y) {
+                                const size_t offset = static_cast<size_t>(y - band) * width;
+                                linkScanline(y, width, adjusted_depth, separation_map, uf,
+                                    sampler ? &*sampler : nullptr, noise.get(), &roots[offset], &rootColors[offset], options);
+                            }
+                            STATS_ADD(Unions, uf.unions);
+                            STATS_ADD(Finds, uf.finds);
+                        }, 8);
+                }
+
+                STATS_SCOPE("sirds.color");
+                for (int y = band; y < bandEnd; ++y) {
+                    const size_t offset = static_cast<size_t>(y - band) * width;
+                    colorScanline(y, width, adjusted_depth, &roots[offset], &rootColors[offset], rootHasColor, batched,
+                        out_rgb, prev_row_colors, have_prev, rng, distr, options);
 
-                std::copy(out_rgb.begin() + static_cast<size_t>(y) * width * 3,
-                    out_rgb.begin() + static_cast<size_t>(y + 1) * width * 3,
-                    prev_row_colors.begin());
-                have_prev = true;
+                    std::copy(out_rgb.begin() + static_cast<size_t>(y) * width * 3,
+                        out_rgb.begin() + static_cast<size_t>(y + 1) * width * 3,
+                        prev_row_colors.begin());
+                    have_prev = true;
+                }
             }
 
             if (options.smoothEdges) {
-                EdgeSmoother::applyEdgeSmoothing(adjusted_depth, out_rgb, options.smoothThreshold, options.smoothWeight, width, height);
+                STATS_SCOPE("sirds.smooth");
+                if (spans) {
+                    // Same mapping as adjustDepthRange
+                    float bg = std::max(0.0f, spans->background * std::max(0.0f, 1.0f - bg_separation));
+                    EdgeSmoother::applyEdgeSmoothing(adjusted_depth, *spans, bg, out_rgb,
+                        options.smoothThreshold, options.smoothWeight, width, height);
+                }
+                else {
+                    EdgeSmoother::applyEdgeSmoothing(adjusted_depth, out_rgb, options.smoothThreshold, options.smoothWeight, width, height);
+                }
             }
         }
 
@@ -118,11 +176,14 @@
         {
             std::vector<float> adjusted_depth(depth.size());
             const float scale = std::max(0.0f, 1.0f - bg_separation);
-            for (size_t i = 0; i < depth.size(); i++) {
-                // Preserve original upper range behavior (no clamp to 1.0)
-                adjusted_depth[i] = std::max(0.0f, depth[i] * scale);
-                // adjusted_depth[i] = std::clamp(adjusted_depth[i], 0.0f, 1.0f);
-            }
+            Parallel::forRange(0, static_cast<int>(depth.size()), [&](int i0, int i1)
+                {
+                    for (int i = i0; i < i1; i++) {
+                        // Preserve original upper range behavior (no clamp to 1.0)
+                        adjusted_depth[i] = std::max(0.0f, depth[i] * scale);
+                        // adjusted_depth[i] = std::clamp(adjusted_depth[i], 0.0f, 1.0f);
+                    }
+                }, 1 << 16);
             return adjusted_depth;
         }
 
@@ -135,48 +196,70 @@
 
             std::vector<int> separation_map(static_cast<size_t>(width) * height);
 
-            for (int y = 0; y < height; ++y) {
-                for (int x = 0; x < width; ++x) {
-                    float d = adjusted_depth[y * width + x];
-
-                    float t = std::pow(std::abs(d - focus_depth) * 2.0f, 1.5f);
-                    float sep_scale = 1.0f + t * 0.5f;
-
-                    // Inverted z: larger depth -> closer -> smaller separation
-                    float sep_float = min_separation +
-                        (max_separation - min_separation) *
-                        std::pow(1.0f - d, options.depth_gamma) * sep_scale;
-
-                    separation_map[y * width + x] = std::clamp(
-                        static_cast<int>(std::round(sep_float)),
-                        min_separation,
-                        max_separation
-                    );
-                }
-            }
+            Parallel::forRange(0, height, [&](int y0, int y1)
+                {
+                    for (int y = y0; y < y1; ++y) {
+                        for (int x = 0; x < width; ++x) {
+                            float d = adjusted_depth[y * width + x];
+
+                            float t = std::pow(std::abs(d - focus_depth) * 2.0f, 1.5f);
+                            float sep_scale = 1.0f + t * 0.5f;
+
+                            // Inverted z: larger depth -> closer -> smaller separation
+                            float sep_float = min_separation +
+                                (max_separation - min_separation) *
+                                std::pow(1.0f - d, options.depth_gamma) * sep_scale;
+
+                            separation_map[y * width + x] = std::clamp(
+                                static_cast<int>(std::round(sep_float)),
+                                min_separation,
+                                max_separation
+                            );
+                        }
+                    }
+                }, 16);
             return separation_map;
         }
 
-        static void processScanline(int y, int width, int height,
+        // Link the row, then store the root of every pixel, and the texture/noise color
+        // of each root that colorScanline will not propagate a color to
+        static void linkScanline(int y, int width,
             const std::vector<float>& adjusted_depth,
             const std::vector<int>& separation_map,
-            UnionFind& uf, const std::vector<uint8_t>& texture,
-            int tw, int th, int tchan, const std::vector<uint8_t>& noiseRGB,
-            std::vector<uint8_t>& out_rgb, const std::vector<uint8_t>& prev_row_colors,
-            bool have_prev, std::mt19937& rng, std::uniform_int_distribution<int>& distr,
-            float brightness, float contrast, const Options& options)
+            UnionFind& uf, TextureSampler::RowSampler* texSampler, const BlueNoise::Sampler* noise,
+            int* root, std::array<uint8_t, 3>* rootColor,
+            const Options& options)
         {
             uf.reset(width);
             buildUnions(y, width, adjusted_depth, separation_map, uf, options);
 
-            std::vector<std::array<uint8_t, 3>> rootColor(width);
-            std::vector<bool> is_root(width, false);
-            std::vector<bool> rootHasColor(width, false);
+            for (int x = 0; x < width; ++x) {
+                root[x] = uf.find(x);
+            }
 
-            identifyRoots(width, uf, is_root);
-            assignColors(y, width, height, adjusted_depth, uf, is_root, rootHasColor, rootColor, texture,
-                tw, th, tchan, noiseRGB, out_rgb, prev_row_colors, have_prev, rng, distr, brightness, contrast, options);
-            applyColors(y, width, uf, rootColor, out_rgb);
+            // Batched texture/noise lookup for runs of consecutive roots that need it
+            if (texSampler || noise) {
+                const float* d = &adjusted_depth[static_cast<size_t>(y) * width];
+                auto needsSample = [&](int x) { return root[x] == x && !propagates(x, y, root, d[x], options); };
+                for (int x = 0; x < width;) {
+                    if (!needsSample(x)) { ++x; continue; }
+                    int xe = x + 1;
+                    while (xe < width && needsSample(xe)) ++xe;
+                    if (texSampler) texSampler->sampleRow(y, x, xe - x, &rootColor[x]);
+                    else noise->colorRun(x, y, xe - x, &rootColor[x]);
+                    x = xe;
+                }
+            }
+        }
+
+        // Whether colorScanline takes the color of root x from a neighbor: near pixels
+        // always do below the first row (from above), and on the first row when the
+        // left pixel's root was colored earlier in the row
+        static bool propagates(int x, int y, const int* root, float d, const Options& options)
+        {
+            if (!(d > options.foreground_threshold)) return false;
+            if (y > 0) return true;
+            return x > 0 && root[x - 1] != x && root[x - 1] < x;
         }
 
         static void buildUnions(int y, int width, const std::vector<float>& adjusted_depth,
@@ -216,66 +299,51 @@
             }
         }
 
-        static void identifyRoots(int width, UnionFind& uf, std::vector<bool>& is_root)
-        {
-            for (int x = 0; x < width; ++x) {
-                is_root[x] = (uf.find(x) == x);
-            }
-        }
-
-        static void assignColors(int y, int width, int height,
+        // Final root colors of the row, propagated from the left or the row above where
+        // the surface is near; roots without a propagated color keep their sampled one
+        static void colorScanline(int y, int width,
             const std::vector<float>& adjusted_depth,
-            UnionFind& uf, const std::vector<bool>& is_root,
-            std::vector<bool>& rootHasColor,
-            std::vector<std::array<uint8_t, 3>>& rootColor,
-            const std::vector<uint8_t>& texture, int tw, int th, int tchan,
-            const std::vector<uint8_t>& noiseRGB,
+            const int* root, std::array<uint8_t, 3>* rootColor,
+            std::vector<bool>& rootHasColor, bool batched,
             std::vector<uint8_t>& out_rgb, const std::vector<uint8_t>& prev_row_colors,
             bool have_prev, std::mt19937& rng,
             std::uniform_int_distribution<int>& distr,
-            float brightness, float contrast, const Options& options)
+            const Options& options)
         {
+            std::fill(rootHasColor.begin(), rootHasColor.end(), false);
+
             for (int x = 0; x < width; ++x) {
-                if (!is_root[x]) continue;
+                if (root[x] != x) continue;
 
                 float d = adjusted_depth[y * width + x];
                 std::array<uint8_t, 3> color{};
                 bool propagated = false;
 
                 if (d > options.foreground_threshold) {
-                    propagated = tryPropagateFromNeighbors(x, y, width, uf, is_root, rootHasColor, rootColor, out_rgb, prev_row_colors, have_prev, color);
+                    propagated = tryPropagateFromNeighbors(x, y, root, rootHasColor, rootColor, prev_row_colors, have_prev, color);
                 }
 
                 if (!propagated) {
-                    if (!texture.empty()) {
-                        color = getTextureColor(x, y, width, height, texture, tw, th, tchan, brightness, contrast, options.tile_texture);
-                    }
-                    else if (!noiseRGB.empty()) {
-                        size_t idx = (static_cast<size_t>(y) * width + x) * 3;
-                        color = { noiseRGB[idx + 0], noiseRGB[idx + 1], noiseRGB[idx + 2] };
-                    }
-                    else {
-                        color = getRandomColor(distr, rng);
-                    }
+                    color = batched ? rootColor[x] : getRandomColor(distr, rng);
                 }
 
                 rootColor[x] = color;
                 rootHasColor[x] = true;
             }
+
+            applyColors(y, width, root, rootColor, out_rgb);
         }
 
-        static bool tryPropagateFromNeighbors(int x, int y, int width, UnionFind& uf,
-            const std::vector<bool>& is_root,
+        static bool tryPropagateFromNeighbors(int x, int y, const int* root,
             const std::vector<bool>& rootHasColor,
-            const std::vector<std::array<uint8_t, 3>>& rootColor,
-            const std::vector<uint8_t>& out_rgb,
+            const std::array<uint8_t, 3>* rootColor,
             const std::vector<uint8_t>& prev_row_colors,
             bool have_prev,
             std::array<uint8_t, 3>& color)
         {
             if (x > 0) {
-                int left_root = uf.find(x - 1);
-                if (left_root != x && is_root[left_root] && rootHasColor[left_root]) {
+                int left_root = root[x - 1];
+                if (left_root != x && rootHasColor[left_root]) {
                     color = rootColor[left_root];
                     return true;
                 }
@@ -296,39 +364,6 @@
             return false;
         }
 
-        static std::array<uint8_t, 3> getTextureColor(int x, int y, int width, int height,
-            const std::vector<uint8_t>& texture,
-            int tw, int th, int tchan,
-            float brightness, float contrast,
-            bool tileTexture)
-        {
-            if (tw <= 0 || th <= 0 || tchan < 3 || texture.empty()) {
-                return { 128, 128, 128 };
-            }
-
-            float texX = static_cast<float>(x) * (static_cast<float>(tw) / width);
-            float texY = static_cast<float>(y) * (static_cast<float>(th) / height);
-
-            std::array<uint8_t, 3> color;
-            if (tileTexture) {
-                color = TextureSampler::sampleBilinearTiled(texture, tw, th, tchan, texX, texY);
-            }
-            else {
-                texX = std::clamp(texX, 0.0f, static_cast<float>(tw - 1));
-                texY = std::clamp(texY, 0.0f, static_cast<float>(th - 1));
-                color = TextureSampler::sampleBilinear(texture, tw, th, tchan, texX, texY);
-            }
-
-            for (int c = 0; c < 3; c++) {
-                float val = color[c] / 255.0f;
-                val = ((val - 0.5f) * contrast) + 0.5f;
-                val *= brightness;
-                color[c] = static_cast<uint8_t>(std::clamp(val * 255.0f, 0.0f, 255.0f));
-            }
-
-            return color;
-        }
-
         static std::array<uint8_t, 3> getRandomColor(std::uniform_int_distribution<int>& distr,
             std::mt19937& rng)
         {
@@ -337,16 +372,15 @@
                      static_cast<uint8_t>(distr(rng)) };
         }
 
-        static void applyColors(int y, int width, UnionFind& uf,
-            const std::vector<std::array<uint8_t, 3>>& rootColor,
+        static void applyColors(int y, int width, const int* root,
+            const std::array<uint8_t, 3>* rootColor,
             std::vector<uint8_t>& out_rgb)
         {
             for (int x = 0; x < width; ++x) {
-                int root = uf.find(x);
                 int idx = (y * width + x) * 3;
-                out_rgb[idx + 0] = rootColor[root][0];
-                out_rgb[idx + 1] = rootColor[root][1];
-                out_rgb[idx + 2] = rootColor[root][2];
+                out_rgb[idx + 0] = rootColor[root[x]][0];
+                out_rgb[idx + 1] = rootColor[root[x]][1];
+                out_rgb[idx + 2] = rootColor[root[x]][2];
             }
         }
 };
@@ -0,0 +1,190 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+#include <type_traits>
+#include <cstdint>
+
+#include "vec3.h"
+#include "Stats.h"
+
+/// <summary>
+/// The inputs a pipeline stage depends on: their bytes, plus a hash of them
+/// for the cache index. Add exactly the Options fields (and upstream keys)
+/// the stage reads, so a change anywhere else leaves its key, and its cached
+/// output, alone. Keys compare by their bytes, so a hash collision is a miss.
+/// </summary>
+class StageKey {
+public:
+    explicit StageKey(const char* stage) { add(std::string(stage)); }
+
+    template <typename T>
+    StageKey& add(const T& value)
+    {
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "StageKey: add fields one by one");
+        // Normalize -0.0f so equal settings hash equal
+        if constexpr (std::is_floating_point_v<T>) {
+            T v = value == T(0) ? T(0) : value;
+            return bytes(&v, sizeof(v));
+        }
+        else {
+            return bytes(&value, sizeof(value));
+        }
+    }
+
+    StageKey& add(const std::string& s)
+    {
+        add(static_cast<uint64_t>(s.size()));
+        return bytes(s.data(), s.size());
+    }
+
+    StageKey& add(const glm::vec3& v) { return add(v.x).add(v.y).add(v.z); }
+
+    StageKey& add(const StageKey& upstream) { return add(upstream.fields); }
+
+    // Path plus the modification time and size of the file, so edits change the key
+    StageKey& addFile(const std::string& path)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        if (ec) return add(path).add(uint64_t(0));
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (ec) return add(path).add(uint64_t(0));
+        return add(path).add(static_cast<uint64_t>(size)).add(static_cast<int64_t>(mtime.time_since_epoch().count()));
+    }
+
+    uint64_t value() const { return h; }
+    bool operator==(const StageKey& o) const { return h == o.h && fields == o.fields; }
+
+private:
+    uint64_t h = 0xCBF29CE484222325ull;
+    std::string fields;
+
+    StageKey& bytes(const void* data, size_t n)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        fields.append(static_cast<const char*>(data), n);
+        for (size_t i = 0; i < n; ++i) {
+            h ^= p[i];
+            h *= 0x100000001B3ull;
+        }
+        return *this;
+    }
+};
+
+/// <summary>
+/// Process-wide LRU cache of pipeline stage outputs, keyed by StageKey. Values
+/// are immutable and shared; each carries its size, and entries are evicted
+/// least recently used first once the byte budget is exceeded.
+/// Thread safe; stages are computed by the caller outside the lock.
+/// </summary>
+class StageCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+    };
+
+    static StageCache& instance()
+    {
+        static StageCache cache;
+        return cache;
+    }
+
+    // Cached output of the stage with this key, or nullptr
+    template <typename T>
+    std::shared_ptr<const T> find(const StageKey& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key.value());
+        if (it == index.end() || !(it->second->key == key)) {
+            ++stats_.misses;
+            STATS_ADD(CacheMisses, 1);
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        ++stats_.hits;
+        STATS_ADD(CacheHits, 1);
+        return std::static_pointer_cast<const T>(it->second->value);
+    }
+
+    // Keep value under key; values larger than the whole budget are not kept
+    template <typename T>
+    void store(const StageKey& key, std::shared_ptr<const T> value, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key.value());
+        if (it != index.end()) {
+            used -= it->second->bytes;
+            lru.erase(it->second);
+            index.erase(it);
+        }
+        if (bytes > budget) return;
+
+        lru.push_front({ key, std::static_pointer_cast<const void>(std::move(value)), bytes });
+        index[key.value()] = lru.begin();
+        used += bytes;
+        evict();
+    }
+
+    void setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s = stats_;
+        s.entries = lru.size();
+        s.bytes = used;
+        s.budget = budget;
+        return s;
+    }
+
+private:
+    struct Entry {
+        StageKey key{ "" };
+        std::shared_ptr<const void> value;
+        size_t bytes = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Entry> lru;       // front = most recently used
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    size_t budget = size_t(256) << 20;
+    size_t used = 0;
+    Stats stats_;
+
+    StageCache() = default;
+    StageCache(const StageCache&) = delete;
+    StageCache& operator=(const StageCache&) = delete;
+
+    void evict()
+    {
+        while (used > budget && !lru.empty()) {
+            used -= lru.back().bytes;
+            index.erase(lru.back().key.value());
+            lru.pop_back();
+            ++stats_.evictions;
+        }
+    }
+};
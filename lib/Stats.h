@@ -0,0 +1,249 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+
+// Compile-time toggle for the instrumentation (on by default, collection is
+// still off until Stats::setEnabled(true)). Define MAGIC_EYE_ENABLE_STATS=0
+// to compile every STATS_ macro away.
+#ifndef MAGIC_EYE_ENABLE_STATS
+#define MAGIC_EYE_ENABLE_STATS 1
+#endif
+
+/// <summary>
+/// Process-wide stage timers and counters. While disabled a scope or counter
+/// costs one relaxed atomic load. Hot loops count into locals and add once
+/// per row, triangle batch or stage.
+/// Reports: a text table, a JSON summary and a Chrome trace_event file
+/// (load it in chrome://tracing or Perfetto).
+/// </summary>
+class Stats {
+public:
+    enum Counter {
+        TrianglesIn,
+        TrianglesClipped,
+        TrianglesCulled,
+        PixelsTested,
+        Unions,
+        Finds,
+        CacheHits,
+        CacheMisses,
+        CounterCount
+    };
+
+    struct StageTotal {
+        std::string name;
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+    };
+
+    static Stats& instance()
+    {
+        static Stats stats;
+        return stats;
+    }
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void setEnabled(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+
+    static void add(Counter c, uint64_t n)
+    {
+        if (enabled()) instance().counters[c].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Times the enclosing block as one trace event
+    class Scope {
+    public:
+        explicit Scope(const char* stage) : stage(enabled() ? stage : nullptr)
+        {
+            if (this->stage) start = now();
+        }
+        ~Scope()
+        {
+            if (stage) instance().record(stage, start, now());
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* stage;
+        uint64_t start = 0;
+    };
+
+    static uint64_t now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static const char* counterName(Counter c)
+    {
+        static const char* names[CounterCount] = {
+            "triangles_in", "triangles_clipped", "triangles_culled", "pixels_tested",
+            "unions", "finds", "cache_hits", "cache_misses"
+        };
+        return names[c];
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.clear();
+        totals.clear();
+        order.clear();
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        epoch = now();
+    }
+
+    uint64_t counter(Counter c) const { return counters[c].load(std::memory_order_relaxed); }
+
+    // Stage totals in first-seen order
+    std::vector<StageTotal> stageTotals() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<StageTotal> out;
+        out.reserve(order.size());
+        for (const auto& name : order) {
+            auto it = totals.find(name);
+            if (it != totals.end()) out.push_back({ name, it->second.calls, it->second.ns });
+        }
+        return out;
+    }
+
+    // Fixed width summary for the console
+    std::string table() const
+    {
+        std::ostringstream os;
+        os << std::left << std::setw(16) << "stage" << std::right << std::setw(8) << "calls"
+            << std::setw(12) << "total ms" << std::setw(12) << "avg ms" << "\n";
+        for (const auto& t : stageTotals()) {
+            const double ms = t.ns / 1e6;
+            os << std::left << std::setw(16) << t.name << std::right << std::setw(8) << t.calls
+                << std::fixed << std::setprecision(3) << std::setw(12) << ms
+                << std::setw(12) << (t.calls ? ms / t.calls : 0.0) << "\n";
+        }
+        for (int c = 0; c < CounterCount; ++c) {
+            os << std::left << std::setw(20) << counterName(static_cast<Counter>(c))
+                << std::right << std::setw(16) << counter(static_cast<Counter>(c)) << "\n";
+        }
+        return os.str();
+    }
+
+    std::string json() const
+    {
+        std::ostringstream os;
+        os << "{\n  \"stages\": [";
+        bool first = true;
+        for (const auto& t : stageTotals()) {
+            os << (first ? "\n" : ",\n") << "    { \"name\": \"" << t.name << "\", \"calls\": " << t.calls
+                << ", \"total_ms\": " << std::fixed << std::setprecision(3) << t.ns / 1e6 << " }";
+            first = false;
+        }
+        os << "\n  ],\n  \"counters\": {";
+        for (int c = 0; c < CounterCount; ++c) {
+            os << (c ? ",\n" : "\n") << "    \"" << counterName(static_cast<Counter>(c)) << "\": "
+                << counter(static_cast<Counter>(c));
+        }
+        os << "\n  }\n}\n";
+        return os.str();
+    }
+
+    // Chrome trace_event format: one complete ("X") event per scope, counters at the end
+    std::string trace() const
+    {
+        std::ostringstream os;
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        std::lock_guard<std::mutex> lock(mutex);
+        bool first = true;
+        uint64_t last = epoch;
+        for (const auto& e : events) {
+            os << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"magic_eye\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << e.tid << std::fixed << std::setprecision(3)
+                << ",\"ts\":" << (e.start - epoch) / 1e3 << ",\"dur\":" << (e.end - e.start) / 1e3 << "}";
+            last = std::max(last, e.end);
+            first = false;
+        }
+        os << (first ? "\n" : ",\n") << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":"
+            << std::fixed << std::setprecision(3) << (last - epoch) / 1e3 << ",\"args\":{";
+        for (int c = 0; c < CounterCount; ++c) {
+            os << (c ? "," : "") << "\"" << counterName(static_cast<Counter>(c)) << "\":"
+                << counters[c].load(std::memory_order_relaxed);
+        }
+        os << "}}\n]}\n";
+        return os.str();
+    }
+
+    static bool writeFile(const std::string& path, const std::string& text)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out << text;
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct Event {
+        const char* name;
+        uint32_t tid;
+        uint64_t start;
+        uint64_t end;
+    };
+    struct Total {
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+    };
+
+    inline static std::atomic<bool> enabled_{ false };
+
+    mutable std::mutex mutex;
+    std::vector<Event> events;
+    std::unordered_map<std::string, Total> totals;
+    std::vector<std::string> order;
+    std::map<std::thread::id, uint32_t> threads;
+    std::array<std::atomic<uint64_t>, CounterCount> counters{};
+    uint64_t epoch = now();
+
+    Stats() = default;
+    Stats(const Stats&) = delete;
+    Stats& operator=(const Stats&) = delete;
+
+    void record(const char* stage, uint64_t start, uint64_t end)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto id = threads.emplace(std::this_thread::get_id(), static_cast<uint32_t>(threads.size() + 1)).first->second;
+        events.push_back({ stage, id, start, end });
+        Total& t = totalFor(stage);
+        t.calls += 1;
+        t.ns += end - start;
+    }
+
+    // Caller holds the mutex
+    Total& totalFor(const char* stage)
+    {
+        auto [it, inserted] = totals.try_emplace(stage);
+        if (inserted) order.push_back(stage);
+        return it->second;
+    }
+};
+
+#if MAGIC_EYE_ENABLE_STATS
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+#define STATS_SCOPE(stage) ::Stats::Scope STATS_CONCAT(stats_scope_, __LINE__)(stage)
+#define STATS_ADD(counter, n) ::Stats::add(::Stats::counter, static_cast<uint64_t>(n))
+#else
+#define STATS_SCOPE(stage) ((void)0)
+#define STATS_ADD(counter, n) ((void)0)
+#endif
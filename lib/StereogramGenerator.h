@@ -5,12 +5,26 @@
 #include <filesystem>
 #include <algorithm>
 #include <cmath>
+#include <atomic>
+#include <functional>
+#include <tuple>
+#include <optional>
 
 #include "Camera.h"
 #include "DepthMapGenerator.h"
+#include "DepthPostProcessor.h"
 #include "SIRDSGenerator.h"
+#include "StageCache.h"
+#include "ThreadPool.h"
+#include "Stats.h"
+#include "TextureCache.h"
 #include "Options.h"
+#include "MemeshFile.h"
+#include "MeshCache.h"
+#include "MeshStream.h"
+#include "Parallel.h"
 #include "objtostl.h"
+#include "StlReader.h"
 #include "Stlsmoother.h"
 #include "stl.h"
 #include "stb_image_impl.h"
@@ -19,112 +33,685 @@ class StereogramGenerator {
 public:
     StereogramGenerator(std::shared_ptr<Options>& opt) : options(opt) {}
 
+    // Cancellation token shared between the caller and a progressive render
+    using CancelToken = std::shared_ptr<std::atomic<bool>>;
+
+    // One published step of a progressive render; buffers are only valid during the callback
+    struct PreviewFrame {
+        int level = 0;          // 0 = coarsest
+        int divisor = 1;        // 1 = full resolution
+        int width = 0;
+        int height = 0;
+        const std::vector<float>& depth;
+        const std::vector<uint8_t>& sirds_rgb;
+    };
+    using PreviewCallback = std::function<void(const PreviewFrame&)>;
+
+    // A finished render, owned by the caller; nothing is written until save
+    struct RenderResult {
+        int width = 0;
+        int height = 0;
+        std::vector<float> depth;           // normalized depth, row major
+        std::vector<uint8_t> depth_vis;     // gray RGB visualization of depth
+        std::vector<uint8_t> sirds_rgb;     // the stereogram, RGB
+    };
+
+    // Render <outprefix>_depth.png and <outprefix>_sirds.png
     int create()
     {
-        if (!options) throw std::runtime_error("StereogramGenerator::create: Options is null.");
+        return save(render()) ? 0 : 1;
+    }
 
-        stl mesh;
+    // Render at full resolution into memory
+    RenderResult render()
+    {
+        RenderResult result;
+        result.width = options->width;
+        result.height = options->height;
+        renderLevel(result.width, result.height, options->eye_sep, result.depth, result.sirds_rgb);
+        result.depth_vis = makeDepthVisualization(result.depth, result.width, result.height);
+        return result;
+    }
 
-        // Detect OBJ vs STL using filesystem::path
-        std::filesystem::path p(options->stlpath);
-        std::string ext = p.has_extension() ? p.extension().string() : std::string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    /// <summary>
+    /// Render at 1/4, 1/2 and full scale, publishing each level through onFrame.
+    /// The mesh and texture are prepared once and shared by all levels.
+    /// The full resolution level ends up in result. Returns false if cancelled.
+    /// </summary>
+    bool renderProgressive(const PreviewCallback& onFrame, RenderResult& result, const CancelToken& cancel = nullptr)
+    {
+        auto cancelled = [&]() { return cancel && cancel->load(); };
 
-        if (ext == ".obj") {
-            if (!OBJToSTL::convert(options->stlpath, mesh)) {
-                throw std::runtime_error("Failed to read OBJ: " + options->stlpath);
-            }
-        }
-        else {
-            if (mesh.read_stl(options->stlpath.c_str()) != 0) {
-                throw std::runtime_error("Failed to read STL: " + options->stlpath);
+        static constexpr int divisors[] = { 4, 2, 1 };
+        std::vector<float> depth;
+        std::vector<uint8_t> sirds_rgb;
+        for (int level = 0; level < 3; ++level) {
+            int d = divisors[level];
+            int w = std::max(1, options->width / d);
+            int h = std::max(1, options->height / d);
+            int sep = std::max(2, options->eye_sep / d);
+
+            if (cancelled()) return false;
+            if (!renderLevel(w, h, sep, depth, sirds_rgb, cancel)) return false;
+
+            if (onFrame) {
+                onFrame(PreviewFrame{ level, d, w, h, depth, sirds_rgb });
             }
         }
 
-        mesh.normalizeAndCenter();
+        result.width = options->width;
+        result.height = options->height;
+        result.depth_vis = makeDepthVisualization(depth, result.width, result.height);
+        result.depth = std::move(depth);
+        result.sirds_rgb = std::move(sirds_rgb);
+        return true;
+    }
+
+    // renderProgressive, then save. Returns 0 when the full resolution level was written, 1 if cancelled.
+    int createProgressive(const PreviewCallback& onFrame, const CancelToken& cancel = nullptr)
+    {
+        RenderResult result;
+        if (!renderProgressive(onFrame, result, cancel)) return 1;
+        return save(result) ? 0 : 1;
+    }
+
+    // Write <outprefix>_depth.png and <outprefix>_sirds.png, encoded concurrently; false if either fails
+    bool save(const RenderResult& result) const
+    {
+        std::string depth_out = options->outprefix + "_depth.png";
+        std::string sirds_out = options->outprefix + "_sirds.png";
+        bool ok = false, ok2 = false;
+        {
+            ThreadPool::TaskGroup encode;
+            encode.run([&]() { ok = writePng(depth_out, result.depth_vis, result.width, result.height); });
+            ok2 = writePng(sirds_out, result.sirds_rgb, result.width, result.height);
+            encode.wait();
+        }
 #ifdef STL_CLI
-        std::cout << "Loaded triangles: " << mesh.m_num_triangles << "\n";
+        if (ok) std::cout << "Wrote depth visualization: " << depth_out << "\n";
+        else std::cerr << "Could not write " << depth_out << "\n";
+        if (ok2) std::cout << "Wrote stereogram: " << sirds_out << "\n";
+        else std::cerr << "Could not write " << sirds_out << "\n";
 #endif
-        transformMesh(mesh, options);
+        return ok && ok2;
+    }
 
-        if (options->laplace_smoothing) {
-            smoothSTL(mesh, options->laplace_smooth_layers);
+    // Gray RGB visualization of a normalized depth map
+    static std::vector<uint8_t> makeDepthVisualization(const std::vector<float>& depth, int width, int height)
+    {
+        std::vector<uint8_t> depth_vis(static_cast<size_t>(width) * height * 3);
+        Parallel::forRange(0, width * height, [&](int i0, int i1)
+            {
+                for (int i = i0; i < i1; ++i) {
+                    uint8_t v = static_cast<uint8_t>(std::round(std::clamp(depth[i], 0.0f, 1.0f) * 255.0f));
+                    depth_vis[i * 3 + 0] = v;
+                    depth_vis[i * 3 + 1] = v;
+                    depth_vis[i * 3 + 2] = v;
+                }
+            }, 1 << 16);
+        return depth_vis;
+    }
+
+private:
+    std::shared_ptr<Options> options;
+
+    struct TextureData {
+        std::shared_ptr<const DecodedTexture> image;    // shared with TextureCache; null -> random dots
+        bool hasTexture = false;
+    };
+
+    // Everything resolution independent: the mesh in model space and the matrix
+    // placing it, the floor in world space, and the camera
+    struct Scene {
+        std::shared_ptr<const stl> mesh;    // shared through MeshCache, never modified
+        glm::mat4 model{ 1.0f };
+        stl floor;
+        Camera cam;
+        float ortho_scale = 1.0f;
+        glm::vec3 center{ 0.0f };
+        glm::vec3 xyzspan{ 0.0f };
+
+        // Streaming: the mesh stays in its file and is transformed chunk by chunk
+        // at every render (model then includes the normalization); the floor is
+        // built from the extents seen on the way
+        std::shared_ptr<const MeshStream> stream;
+    };
+
+    // Resolved once per generator; the caches behind them are shared
+    std::shared_ptr<const Scene> scene_;
+    std::optional<TextureData> texture_;
+
+    Scene prepareScene()
+    {
+        if (!options) throw std::runtime_error("StereogramGenerator::create: Options is null.");
+
+        Scene scene;
+
+        if (options->stream_mesh) {
+            auto stream = std::make_shared<MeshStream>();
+            if (stream->open(options->stlpath)) {
+                scene.stream = stream;
+                prepareStreamedScene(scene);
+                return scene;
+            }
+#ifdef STL_CLI
+            std::cout << "Streaming needs a binary STL; loading " << options->stlpath << " instead\n";
+#endif
         }
 
-        auto [center, xyzspan] = calculateMeshBounds(mesh.m_vectors.data(), mesh.m_num_triangles * 3);
+        scene.mesh = loadMesh(scene.model);
+        const float* vdata = scene.mesh->m_vectors.data();
+        const size_t vcount = static_cast<size_t>(scene.mesh->m_num_triangles) * 3;
+
+        // Bounds of the placed mesh and, when the view direction is fixed by the
+        // options, the depth extents for the floor come out of one read-only pass
+        const bool floor = options->add_floor && options->rampWidth > 0.0f;
+        glm::vec3 viewDir;
+        const bool knownDir = floor && presetViewDirection(viewDir);
+        vectorutils::Extents extents;
+        {
+            STATS_SCOPE("transform");
+            extents = vectorutils::transformedExtents(vdata, vcount, scene.model, knownDir ? &viewDir : nullptr);
+        }
+        std::tie(scene.center, scene.xyzspan) = boundsOf(extents);
 
-        float span = std::max({ xyzspan[0], xyzspan[1], xyzspan[2], 1e-6f});
+        float span = std::max({ scene.xyzspan[0], scene.xyzspan[1], scene.xyzspan[2], 1e-6f});
 
-        Camera cam = setupCamera(options, center, span);
+        scene.cam = setupCamera(options, scene.center, span);
 
         // Optional floor
-        if (options->add_floor && options->rampWidth > 0.0f) {
-            addFloorRampFacingCamera(mesh, cam, center, xyzspan,
+        if (floor) {
+            STATS_SCOPE("floor");
+            float dMin, dMax;
+            if (!knownDir || !forwardFromDirection(scene.cam, scene.center, viewDir, extents, dMin, dMax)) {
+                const glm::vec3 forward = floorForward(scene.cam, scene.center);
+                vectorutils::Extents e = vectorutils::transformedExtents(vdata, vcount, scene.model, &forward);
+                const float eyeDist = glm::dot(scene.cam.position, forward);
+                dMin = e.dlo - eyeDist;
+                dMax = e.dhi - eyeDist;
+            }
+            addFloorRamp(scene.floor, scene.cam, scene.center, scene.xyzspan, dMin, dMax,
                 options->rampWidth, options->rampSep, options->rampAngle);
         }
 
-        float ortho_scale = calculateOrthoScale(options, span);
+        scene.ortho_scale = calculateOrthoScale(options, span);
+        return scene;
+    }
 
+    // Depth map of one output size, with the spans SIRDS may use
+    struct DepthStage {
+        std::vector<float> depth;
+        ForegroundSpans spans;
+        bool spansValid = false;
         float zmin = 0.0f, zmax = 0.0f;
-        auto depth = DepthMapGenerator::generate(mesh, options->width, options->height,
-            cam, ortho_scale, zmin, zmax,
-            options->depth_near, options->depth_far,
-            options->bg_separation);
 
+        size_t bytes() const
+        {
+            return sizeof(*this) + depth.size() * sizeof(float)
+                + spans.rowStart.size() * sizeof(int) + spans.spans.size() * sizeof(ForegroundSpans::Span);
+        }
+    };
+
+    /// <summary>
+    /// Depth + SIRDS for one output size. Returns false if cancelled; rasterization
+    /// polls the token too, so a cancel does not wait for the whole depth map.
+    /// Each stage is looked up in StageCache by the inputs it depends on and only
+    /// computed on a miss; the scene and texture are only prepared when needed.
+    /// </summary>
+    bool renderLevel(int width, int height, int eye_sep,
+        std::vector<float>& depth, std::vector<uint8_t>& sirds_rgb,
+        const CancelToken& cancel = nullptr)
+    {
+        StageCache& cache = StageCache::instance();
+
+        // Pixel sizes in Options are given at full resolution; preview levels scale them down
+        const float levelScale = static_cast<float>(width) / std::max(1, options->width);
+
+        // A random seed gives a new pattern every time, so there is nothing to reuse
+        const bool cacheSirds = options->rng_seed >= 0;
+        const StageKey dkey = depthKey(width, height, levelScale);
+        const StageKey skey = sirdsKey(dkey, eye_sep);
+        std::shared_ptr<const std::vector<uint8_t>> cachedSirds;
+        if (cacheSirds) cachedSirds = cache.find<std::vector<uint8_t>>(skey);
+
+        // Depth -> SIRDS; the texture does not depend on the depth map, so it is
+        // loaded while the mesh is rasterized
+        std::shared_ptr<const DepthStage> stage;
+        bool cancelled = false;
+        ThreadPool::TaskGraph graph;
+        const int depthNode = graph.add([&]()
+            {
+                stage = cache.find<DepthStage>(dkey);
+                if (!stage) {
+                    auto computed = std::make_shared<DepthStage>();
+                    if (!renderDepth(scene(), width, height, levelScale, *computed, cancel)) {
+                        cancelled = true;   // incomplete, never cached
+                        return;
+                    }
+                    cache.store<DepthStage>(dkey, computed, computed->bytes());
+                    stage = computed;
+                }
+#ifdef STL_CLI
+                else {
+                    std::cout << "Reusing depth map " << width << "x" << height << "\n";
+                }
+                std::cout << "Depth zmin=" << stage->zmin << " zmax=" << stage->zmax << "\n";
+#endif
+            });
+        if (!cachedSirds) {
+            const int textureNode = graph.add([&]() { texture(); });
+            graph.add([&]()
+                {
+                    if (cancelled || (cancel && cancel->load())) {
+                        cancelled = true;
+                        return;
+                    }
+                    generateSirds(*stage, width, height, eye_sep, sirds_rgb);
+                    if (cacheSirds) {
+                        cache.store<std::vector<uint8_t>>(skey, std::make_shared<const std::vector<uint8_t>>(sirds_rgb),
+                            sirds_rgb.size() + sizeof(sirds_rgb));
+                    }
+                }, { depthNode, textureNode });
+        }
+        graph.run();
+        if (cancelled) return false;
+
+        depth = stage->depth;
+
+        if (cachedSirds) {
+            if (cancel && cancel->load()) return false;
 #ifdef STL_CLI
-        std::cout << "Depth zmin=" << zmin << " zmax=" << zmax << "\n";
+            std::cout << "Reusing stereogram " << width << "x" << height << "\n";
 #endif
-        saveDepthVisualization(depth, options);
+            sirds_rgb = *cachedSirds;
+        }
+        return true;
+    }
 
-        auto textureData = loadTexture(options);
+    void generateSirds(const DepthStage& stage, int width, int height, int eye_sep, std::vector<uint8_t>& sirds_rgb)
+    {
+        // Sample the pyramid level closest to the output size
+        const TextureData& textureData = texture();
+        TextureView tex;
+        if (textureData.image) {
+            const DecodedTexture& image = *textureData.image;
+            tex = image.view();
+            int level = TextureSampler::selectMipLevel(tex.w, tex.h, width, height, static_cast<int>(image.mips.size()));
+            if (level > 0) {
+                tex = image.mips[level - 1].view();
+            }
+        }
 
-        std::vector<uint8_t> sirds_rgb;
-        SIRDSGenerator::generate(depth, options->width, options->height, options->eye_sep,
-            textureData.texture, textureData.tw, textureData.th, textureData.tchan,
+        SIRDSGenerator::generate(stage.depth, width, height, eye_sep, tex,
             sirds_rgb, options->texture_brightness, options->texture_contrast,
-            options->bg_separation, options);
+            options->bg_separation, options, stage.spansValid ? &stage.spans : nullptr);
+    }
 
-        saveStereogram(sirds_rgb, options);
+    // Returns false, with out incomplete, if cancel was set while rasterizing
+    bool renderDepth(const Scene& scene, int width, int height, float levelScale, DepthStage& out,
+        const CancelToken& cancel = nullptr)
+    {
+        if (scene.stream) {
+            out.depth = rasterizeStreamed(scene, width, height, out.zmin, out.zmax, &out.spans, levelScale, cancel);
+            if (cancel && cancel->load()) return false;
+        }
+        else {
+            DepthMapGenerator::Raster raster(width, height, scene.cam, scene.ortho_scale);
+            raster.setCancel(cancel.get());
+            raster.add(scene.mesh->m_vectors.data(), scene.mesh->m_num_triangles, scene.model);
+            raster.add(scene.floor.m_vectors.data(), scene.floor.m_num_triangles);
+            if (raster.cancelled()) return false;
+            out.depth = raster.finish(out.zmin, out.zmax, options->depth_near, options->depth_far,
+                options->bg_separation, &out.spans,
+                options->fill_holes, options->fill_holes_max_radius * levelScale);
+        }
 
-        return 0;
+        out.spansValid = true;
+        if (options->bilateral_depth) {
+            float sigma = options->bilateral_sigma_spatial * levelScale;
+            STATS_SCOPE("bilateral");
+            DepthPostProcessor::bilateralSmooth(out.depth, width, height, std::max(0.5f, sigma), options->bilateral_sigma_range);
+            // Filtering can move background pixels next to the silhouette, so the spans no longer hold
+            out.spansValid = false;
+        }
+        return true;
     }
 
-private:
-    std::shared_ptr<Options> options;
+    // The scene of the current options, shared through StageCache
+    const Scene& scene()
+    {
+        if (!scene_) {
+            const StageKey key = sceneKey();
+            scene_ = StageCache::instance().find<Scene>(key);
+            if (!scene_) {
+                auto prepared = std::make_shared<Scene>(prepareScene());
+                size_t bytes = sizeof(Scene) + MeshCache::bytesOf(prepared->floor)
+                    + (prepared->mesh ? MeshCache::bytesOf(*prepared->mesh) : 0);
+                StageCache::instance().store<Scene>(key, prepared, bytes);
+                scene_ = prepared;
+            }
+        }
+        return *scene_;
+    }
 
-    struct TextureData {
-        std::vector<uint8_t> texture;
-        int tw = 0;
-        int th = 0;
-        int tchan = 0;
-        bool hasTexture = false;
-    };
+    const TextureData& texture()
+    {
+        if (!texture_) texture_ = loadTexture(options);
+        return *texture_;
+    }
+
+    // Everything prepareScene reads
+    StageKey sceneKey() const
+    {
+        StageKey key("scene");
+        key.addFile(options->stlpath).add(options->stream_mesh).add(meshVariant(options))
+            .add(options->sc).add(options->shear).add(options->rot_deg).add(options->trans)
+            .add(options->custom_cam_provided).add(options->custom_cam_pos)
+            .add(options->custom_lookat_provided).add(options->custom_look_at)
+            .add(options->perspective).add(options->fov)
+            .add(options->add_floor).add(options->rampWidth).add(options->rampSep).add(options->rampAngle)
+            .add(options->custom_orth_scale_provided).add(options->custom_orth_scale)
+            .add(options->orthTuneLow).add(options->orthTuneHi)
+            .add(options->width).add(options->height);
+        return key;
+    }
+
+    // The scene plus everything renderDepth reads
+    StageKey depthKey(int width, int height, float levelScale) const
+    {
+        StageKey key("depth");
+        key.add(sceneKey()).add(width).add(height)
+            .add(options->depth_near).add(options->depth_far).add(options->bg_separation)
+            .add(options->fill_holes).add(options->fill_holes ? options->fill_holes_max_radius * levelScale : 0.0f)
+            .add(options->bilateral_depth);
+        if (options->bilateral_depth) {
+            key.add(options->bilateral_sigma_spatial * levelScale).add(options->bilateral_sigma_range);
+        }
+        return key;
+    }
+
+    // The depth map plus the texture and every Options field SIRDSGenerator reads
+    StageKey sirdsKey(const StageKey& depth, int eye_sep) const
+    {
+        StageKey key("sirds");
+        key.add(depth).add(eye_sep);
+        if (!options->texpath.empty() && options->texpath != "null") {
+            key.addFile(options->texpath);
+        }
+        else {
+            key.add(std::string("null"));
+        }
+        key.add(options->texture_brightness).add(options->texture_contrast).add(options->bg_separation)
+            .add(options->depth_gamma).add(options->foreground_threshold)
+            .add(options->occlusion).add(options->occlusion_epsilon).add(options->rng_seed)
+            .add(options->smoothEdges).add(options->smoothThreshold).add(options->smoothWeight)
+            .add(options->tile_texture);
+        return key;
+    }
+
+    // Streaming setup: one pass for the source bounds (normalization), one for the
+    // transformed bounds (camera). Nothing of the mesh is kept.
+    void prepareStreamedScene(Scene& scene)
+    {
+        const MeshStream& stream = *scene.stream;
+#ifdef STL_CLI
+        std::cout << "Streaming triangles: " << stream.triangleCount() << "\n";
+        if (options->laplace_smoothing) {
+            std::cout << "Laplace smoothing needs the whole mesh; skipped while streaming\n";
+        }
+#endif
+        // Normalization followed by the model transform, as one matrix
+        glm::mat4 normalize(1.0f);
+        float lo[3], hi[3];
+        if (stream.bounds(lo, hi)) {
+            float scale[3], offset[3];
+            IndexedMesh::normalization(lo, hi, scale, offset);
+            for (int a = 0; a < 3; ++a) {
+                normalize[a][a] = scale[a];
+                normalize[3][a] = offset[a];
+            }
+        }
+        scene.model = vectorutils::composeTransform(options->sc, options->shear, options->rot_deg, options->trans) * normalize;
+
+        STATS_SCOPE("transform");
+        vectorutils::Extents extents;
+        stream.forEachChunk([](float*, size_t) {}, [&](const float* xyz, size_t n)
+            {
+                extents.merge(vectorutils::transformedExtents(xyz, n * 3, scene.model));
+            });
+
+        std::tie(scene.center, scene.xyzspan) = boundsOf(extents);
+        float span = std::max({ scene.xyzspan[0], scene.xyzspan[1], scene.xyzspan[2], 1e-6f });
+
+        scene.cam = setupCamera(options, scene.center, span);
+        scene.ortho_scale = calculateOrthoScale(options, span);
+    }
+
+    // Depth map of a streamed scene: one pass over the file feeds the rasterizer
+    // and collects the extents for the floor, which is rasterized last
+    std::vector<float> rasterizeStreamed(const Scene& scene, int width, int height,
+        float& zmin, float& zmax, ForegroundSpans* spans, float levelScale, const CancelToken& cancel = nullptr)
+    {
+        DepthMapGenerator::Raster raster(width, height, scene.cam, scene.ortho_scale);
+        raster.setCancel(cancel.get());
+        const glm::vec3 forward = floorForward(scene.cam, scene.center);
+        vectorutils::Extents extents;
+
+        // The chunk copy is transformed in place, collecting dot(p, forward) on the
+        // way; the eye offset is subtracted once
+        scene.stream->forEachChunk([&](float* xyz, size_t vcount) { extents.merge(vectorutils::transformExtents(xyz, vcount, scene.model, &forward)); },
+            [&](const float* xyz, size_t n) { raster.add(xyz, n); });
+        if (raster.cancelled()) return {};
+        const float eyeDist = glm::dot(scene.cam.position, forward);
+        const float dMin = extents.dlo - eyeDist;
+        const float dMax = extents.dhi - eyeDist;
+
+        if (options->add_floor && options->rampWidth > 0.0f) {
+            stl floor;
+            addFloorRamp(floor, scene.cam, scene.center, scene.xyzspan, dMin, dMax,
+                options->rampWidth, options->rampSep, options->rampAngle);
+            raster.add(floor.m_vectors.data(), floor.m_num_triangles);
+        }
+
+        return raster.finish(zmin, zmax, options->depth_near, options->depth_far,
+            options->bg_separation, spans,
+            options->fill_holes, options->fill_holes_max_radius * levelScale);
+    }
+
+    /// <summary>
+    /// The mesh in model space plus the model matrix placing it. Loading,
+    /// normalization and smoothing happen once per file and settings; the result
+    /// is shared read-only through MeshCache, so a change of rotation, scale,
+    /// shear or camera only re-rasterizes. The one exception is a smoothed mesh
+    /// under non-uniform scale or shear: cotan weights are not invariant under
+    /// those, so it is transformed first and smoothed in world space as before.
+    /// </summary>
+    std::shared_ptr<const stl> loadMesh(glm::mat4& model)
+    {
+        model = vectorutils::composeTransform(options->sc, options->shear, options->rot_deg, options->trans);
+
+        if (options->laplace_smoothing && !isSimilarity(options)) {
+            IndexedMesh source = loadSource();
+#ifdef STL_CLI
+            std::cout << "Loaded triangles: " << source.triangleCount() << "\n";
+#endif
+            transformVertices(source.positions.data(), source.vertexCount(), options);
+            auto mesh = std::make_shared<stl>();
+            smoothSource(source, *mesh);
+            model = glm::mat4(1.0f);
+            return mesh;
+        }
+
+        bool loaded = false;
+        auto mesh = MeshCache::instance().get(options->stlpath, meshVariant(options), [&]()
+            {
+                auto mesh = std::make_shared<stl>();
+                MemeshFile::View cached;
+                if (!options->laplace_smoothing && loadCache(cached)) {
+                    // Nothing to smooth: expand straight from the mapping
+                    STATS_SCOPE("load");
+                    IndexedMesh::toSoup(cached.positions, cached.vertexCount, cached.indices, cached.indexCount, *mesh);
+                }
+                else {
+                    IndexedMesh source = loadSource();
+                    smoothSource(source, *mesh);
+                }
+#ifdef STL_CLI
+                std::cout << "Loaded triangles: " << mesh->m_num_triangles << "\n";
+#endif
+                loaded = true;
+                return std::shared_ptr<const stl>(std::move(mesh));
+            });
+        if (!mesh) {
+            throw std::runtime_error("Failed to read model: " + options->stlpath);
+        }
+#ifdef STL_CLI
+        if (!loaded) {
+            std::cout << "Reusing loaded mesh: " << mesh->m_num_triangles << " triangles\n";
+        }
+#endif
+        return mesh;
+    }
+
+    // Optional Laplace smoothing, then the triangle soup the rasterizer reads
+    void smoothSource(IndexedMesh& source, stl& mesh)
+    {
+        const SmoothMode smoothMode = options->laplace_implicit ? SmoothMode::Implicit : SmoothMode::Taubin;
+        if (source.isSoup()) {
+            mesh.m_num_triangles = static_cast<uint32_t>(source.triangleCount());
+            mesh.m_vectors = std::move(source.positions);
+            if (options->laplace_smoothing) {
+                STATS_SCOPE("smooth");
+                smoothSTL(mesh, options->laplace_smooth_layers, smoothMode, options->laplace_lambda);
+            }
+        }
+        else {
+            // Smooth the shared vertices, then expand once
+            if (options->laplace_smoothing) {
+                STATS_SCOPE("smooth");
+                smoothIndexed(source, options->laplace_smooth_layers, smoothMode, options->laplace_lambda);
+            }
+            source.toSoup(mesh);
+        }
+    }
+
+    // The Options fields that change the model space mesh
+    static std::string meshVariant(const std::shared_ptr<Options>& options)
+    {
+        if (!options->laplace_smoothing) return "raw";
+        if (options->laplace_implicit) return "implicit:" + std::to_string(options->laplace_lambda);
+        return "taubin:" + std::to_string(options->laplace_smooth_layers);
+    }
+
+    // Rotation, translation and uniform scale (mirroring included) keep angles
+    static bool isSimilarity(const std::shared_ptr<Options>& options)
+    {
+        const glm::vec3& sc = options->sc;
+        return options->shear.x == 0.0f && options->shear.y == 0.0f && options->shear.z == 0.0f
+            && std::abs(sc.x) == std::abs(sc.y) && std::abs(sc.y) == std::abs(sc.z);
+    }
+
+    // Map <model>.memesh if mesh_cache is set and the file is current
+    bool loadCache(MemeshFile::View& cached)
+    {
+        if (!options->mesh_cache || !MemeshFile::load(options->stlpath, cached)) return false;
+#ifdef STL_CLI
+        std::cout << "Loaded mesh cache " << MemeshFile::pathFor(options->stlpath) << "\n";
+#endif
+        return true;
+    }
 
-    void transformMesh(stl& mesh, const std::shared_ptr<Options>& options)
+    // Normalized source geometry: STL stays a soup, OBJ keeps its indices.
+    // With mesh_cache set it comes from <model>.memesh when that is current.
+    IndexedMesh loadSource()
     {
-        float* vdata = mesh.m_vectors.data();
-        size_t vcount = static_cast<size_t>(mesh.m_num_triangles) * 3;
+        STATS_SCOPE("load");
+        IndexedMesh source;
+        MemeshFile::View cached;
+        if (loadCache(cached)) {
+            MemeshFile::copy(cached, source);
+            return source;
+        }
+
+        // Detect OBJ vs STL using filesystem::path
+        std::filesystem::path p(options->stlpath);
+        std::string ext = p.has_extension() ? p.extension().string() : std::string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
 
-        vectorutils::scale(vdata, static_cast<uint32_t>(vcount), options->sc.x, options->sc.y, options->sc.z);
-        vectorutils::shear_mesh(vdata, static_cast<uint32_t>(vcount), options->shear.x, options->shear.y, options->shear.z);
-        vectorutils::rotateQuaternion(vdata, static_cast<uint32_t>(vcount), options->rot_deg.x, options->rot_deg.y, options->rot_deg.z, glm::vec3(0, 0, 0));
-        vectorutils::translate(vdata, static_cast<uint32_t>(vcount), options->trans.x, options->trans.y, options->trans.z);
+        if (ext == ".obj") {
+            if (!OBJToSTL::load(options->stlpath, source)) {
+                throw std::runtime_error("Failed to read OBJ: " + options->stlpath);
+            }
+            source.normalizeAndCenter();
+        }
+        else {
+            stl raw;
+            if (!StlReader::read(options->stlpath, raw)) {
+                throw std::runtime_error("Failed to read STL: " + options->stlpath);
+            }
+            raw.normalizeAndCenter();
+            source.positions = std::move(raw.m_vectors);
+        }
+
+        if (options->mesh_cache) {
+            bool saved = MemeshFile::save(options->stlpath, source);
+#ifdef STL_CLI
+            std::cout << (saved ? "Wrote mesh cache " : "Could not write mesh cache ") << MemeshFile::pathFor(options->stlpath) << "\n";
+#else
+            (void)saved;
+#endif
+        }
+        return source;
     }
 
-    std::pair<glm::vec3, glm::vec3> calculateMeshBounds(const float* vdata, size_t vcount)
+    // Scale, shear, rotate and translate composed into one matrix and applied in a
+    // single pass, which also returns the bounds (and extents along dir, if given)
+    vectorutils::Extents transformVertices(float* vdata, size_t vcount, const std::shared_ptr<Options>& options,
+        const glm::vec3* dir = nullptr)
     {
-        float minx = 1e9f, miny = 1e9f, minz = 1e9f;
-        float maxx = -1e9f, maxy = -1e9f, maxz = -1e9f;
+        STATS_SCOPE("transform");
+        return vectorutils::transformExtents(vdata, vcount,
+            vectorutils::composeTransform(options->sc, options->shear, options->rot_deg, options->trans), dir);
+    }
 
-        vectorutils::min_max(vdata, static_cast<uint32_t>(vcount), minx, maxx, miny, maxy, minz, maxz);
+    static std::pair<glm::vec3, glm::vec3> boundsOf(const vectorutils::Extents& e)
+    {
+        if (!(e.lo[0] <= e.hi[0])) return { glm::vec3(0.0f), glm::vec3(0.0f) };    // empty mesh
 
-        glm::vec3 center = { (minx + maxx) * 0.5f, (miny + maxy) * 0.5f, (minz + maxz) * 0.5f };
-        float spanx = maxx - minx;
-        float spany = maxy - miny;
-        float spanz = maxz - minz;
-        
+        glm::vec3 center = { (e.lo[0] + e.hi[0]) * 0.5f, (e.lo[1] + e.hi[1]) * 0.5f, (e.lo[2] + e.hi[2]) * 0.5f };
+        return { center, { e.hi[0] - e.lo[0], e.hi[1] - e.lo[1], e.hi[2] - e.lo[2] } };
+    }
 
-        return { center, {spanx, spany, spanz } };
+    // View direction that does not depend on the mesh bounds: both camera and
+    // target given, or neither (the default camera looks down -z at the center)
+    bool presetViewDirection(glm::vec3& dir) const
+    {
+        if (options->custom_cam_provided && options->custom_lookat_provided) {
+            glm::vec3 d = options->custom_look_at - options->custom_cam_pos;
+            if (glm::dot(d, d) <= 0.0f) return false;
+            dir = glm::normalize(d);
+            return true;
+        }
+        if (!options->custom_cam_provided && !options->custom_lookat_provided) {
+            dir = { 0.0f, 0.0f, -1.0f };
+            return true;
+        }
+        return false;
+    }
+
+    // Forward extents of the mesh from its extents along dir; false when the floor
+    // direction is not (anti)parallel to dir and a separate scan is needed
+    static bool forwardFromDirection(const Camera& cam, const glm::vec3& center, const glm::vec3& dir,
+        const vectorutils::Extents& e, float& dMin, float& dMax)
+    {
+        const glm::vec3 forward = floorForward(cam, center);
+        const float s = glm::dot(forward, dir);
+        if (std::abs(s) < 1.0f - 1e-5f || !(e.dlo <= e.dhi)) return false;
+
+        const float eyeDist = glm::dot(cam.position, forward);
+        dMin = (s > 0.0f ? e.dlo : e.dhi) * s - eyeDist;
+        dMax = (s > 0.0f ? e.dhi : e.dlo) * s - eyeDist;
+        return true;
     }
 
     Camera setupCamera(const std::shared_ptr<Options>& options, const glm::vec3& center, float span)
@@ -162,34 +749,30 @@ private:
         return scale;
     }
 
-    void saveDepthVisualization(const std::vector<float>& depth, const std::shared_ptr<Options>& options)
+    static bool writePng(const std::string& path, const std::vector<uint8_t>& rgb, int width, int height)
     {
-        std::vector<uint8_t> depth_vis(static_cast<size_t>(options->width) * options->height * 3);
-        for (int i = 0; i < options->width * options->height; ++i) {
-            uint8_t v = static_cast<uint8_t>(std::round(std::clamp(depth[i], 0.0f, 1.0f) * 255.0f));
-            depth_vis[i * 3 + 0] = v;
-            depth_vis[i * 3 + 1] = v;
-            depth_vis[i * 3 + 2] = v;
-        }
-
-        std::string depth_out = options->outprefix + "_depth.png";
-        stbi_write_png(depth_out.c_str(), options->width, options->height, 3,
-            depth_vis.data(), options->width * 3);
-#ifdef STL_CLI
-        std::cout << "Wrote depth visualization: " << depth_out << "\n";
-#endif
+        if (rgb.size() < static_cast<size_t>(width) * height * 3) return false;
+        STATS_SCOPE("encode");
+        return stbi_write_png(path.c_str(), width, height, 3, rgb.data(), width * 3) != 0;
     }
 
     TextureData loadTexture(const std::shared_ptr<Options>& options)
     {
+        STATS_SCOPE("texture");
         TextureData data;
 
         if (!options->texpath.empty() && options->texpath != "null") {
-            if (TextureSampler::loadRGB(options->texpath, data.texture, data.tw, data.th, data.tchan)) {
+            // Decoded once per file version and shared by every render in the process
+            data.image = TextureCache::instance().load(options->texpath);
+            if (data.image) {
                 data.hasTexture = true;
 #ifdef STL_CLI
+                auto stats = TextureCache::instance().stats();
                 std::cout << "Loaded texture " << options->texpath << " ("
-                    << data.tw << "x" << data.th << " ch=" << data.tchan << ")\n";
+                    << data.image->view().w << "x" << data.image->view().h << " ch=" << data.image->view().channels
+                    << (data.image->image.isMapped() ? " mapped" : "")
+                    << ", " << data.image->mips.size() << " mip levels, cache "
+                    << stats.hits << " hits / " << stats.misses << " misses)\n";
 #endif
             }
             else {
@@ -205,27 +788,28 @@ private:
         return data;
     }
 
-    void saveStereogram(const std::vector<uint8_t>& sirds_rgb, const std::shared_ptr<Options>& options)
+    // 'forward' oriented from the camera into the scene
+    static glm::vec3 floorForward(const Camera& cam, const glm::vec3& center)
     {
-        std::string sirds_out = options->outprefix + "_sirds.png";
-        stbi_write_png(sirds_out.c_str(), options->width, options->height, 3,
-            sirds_rgb.data(), options->width * 3);
-#ifdef STL_CLI
-        std::cout << "Wrote stereogram: " << sirds_out << "\n";
-#endif
+        glm::vec3 right, up, forward;
+        cam.computeBasis(right, up, forward);
+        if (glm::dot(center - cam.position, forward) < 0.0f)
+            forward = -forward;
+        return forward;
     }
 
-    void addFloorRampFacingCamera(
+    // Floor quad from precomputed forward extents of the image mesh
+    void addFloorRamp(
         stl& mesh,
         const Camera& cam,
-        const glm::vec3& center, // world-space center of the image mesh
-        const glm::vec3& xyzspan,   // image mesh span (as before)
-        float rampWidth,         // horizontal width fraction [0..1]
+        const glm::vec3& center,
+        const glm::vec3& xyzspan,
+        float dMin,
+        float dMax,
+        float rampWidth,
         float rampSep,
-        float floorAngleDeg,     // 90 = straight toward camera, >90 = slopes down along -up
-        const glm::vec3& color = { 0.8f, 0.8f, 0.8f }
-
-    )
+        float floorAngleDeg,
+        const glm::vec3& color = { 0.8f, 0.8f, 0.8f })
     {
         auto xspan = xyzspan[0];
         auto yspan = xyzspan[1];
@@ -240,8 +824,7 @@ private:
         span += span * 0.05f;
 
         // Ensure 'forward' points from camera into the scene
-        if (glm::dot(center - cam.position, forward) < 0.0f)
-            forward = -forward;
+        forward = floorForward(cam, center);
 
         float halfx = xspan * rampWidth * 0.5f;
         float gap = yspan * rampSep;   // small gap under the image
@@ -249,17 +832,6 @@ private:
         // The line we visually attach to (bottom of the image mesh)
         glm::vec3 topCenter = center - up * (0.5f * yspan + gap);
 
-        // Scan current mesh to find frontmost/farthest distances along 'forward'
-        float dMin = std::numeric_limits<float>::infinity();      // closest to camera
-        float dMax = -std::numeric_limits<float>::infinity();     // farthest from camera
-        const auto& V = mesh.m_vectors;
-        for (size_t i = 0; i + 2 < V.size(); i += 3) {
-            glm::vec3 p(V[i + 0], V[i + 1], V[i + 2]);
-            float d = glm::dot(p - cam.position, forward); // distance along 'forward'
-            dMin = std::min(dMin, d);
-            dMax = std::max(dMax, d);
-        }
-
         // Fallback if the mesh is empty
         float dTop = glm::dot(topCenter - cam.position, forward);
         if (!std::isfinite(dMin) || !std::isfinite(dMax)) {
@@ -0,0 +1,233 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <charconv>
+#include <memory>
+
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "stl.h"
+
+/// <summary>
+/// In-tree STL reader. The file is memory mapped; binary facets are copied out
+/// in parallel, ASCII files are cut at facet boundaries and the pieces parsed
+/// in parallel. Produces the same triangle soup (9 floats per triangle) that
+/// stl::read_stl does.
+/// </summary>
+class StlReader {
+public:
+    static constexpr size_t kHeaderSize = 84;   // 80 byte header + uint32 count
+    static constexpr size_t kFacetSize = 50;    // normal, 3 vertices, uint16 attribute
+
+    // Binary facets as they sit in the mapping: 50 byte records, no copy made
+    struct BinaryView {
+        const uint8_t* facets = nullptr;
+        size_t count = 0;
+
+        // Copy the vertices of triangles [first, first + n) into xyz (9 floats each)
+        void copy(size_t first, size_t n, float* xyz) const
+        {
+            const uint8_t* src = facets + first * kFacetSize + 12;     // skip the normal
+            for (size_t t = 0; t < n; ++t, src += kFacetSize, xyz += 9) {
+                std::memcpy(xyz, src, 9 * sizeof(float));
+            }
+        }
+    };
+
+    // True if data is long enough to hold the binary facets its header announces
+    static bool binaryView(const uint8_t* data, size_t size, BinaryView& view)
+    {
+        if (size < kHeaderSize) return false;
+        uint32_t count;
+        std::memcpy(&count, data + 80, sizeof(count));
+        if (kHeaderSize + static_cast<size_t>(count) * kFacetSize > size) return false;
+        view.facets = data + kHeaderSize;
+        view.count = count;
+        return true;
+    }
+
+    // True if data is a binary STL. Binary headers may start with "solid" too, so a
+    // file that does is only binary when its size matches the facet count exactly;
+    // the count an ASCII header's bytes 80-83 spell is arbitrary.
+    static bool isBinary(const uint8_t* data, size_t size)
+    {
+        BinaryView view;
+        if (!binaryView(data, size, view)) return false;
+        return kHeaderSize + view.count * kFacetSize == size || !isAscii(data, size);
+    }
+
+    /// <summary>
+    /// Read a binary or ASCII STL into xyz (9 floats per triangle).
+    /// Returns false if the file cannot be mapped or parsed, or holds no triangles.
+    /// </summary>
+    static bool read(const std::string& path, std::vector<float>& xyz)
+    {
+        xyz.clear();
+        MappedFile file(path);
+        if (!file.isOpen()) return false;
+
+        BinaryView view;
+        const bool binary = binaryView(file.data(), file.size(), view);
+        if (binary && isBinary(file.data(), file.size())) {
+            readBinary(view, xyz);
+            return !xyz.empty();
+        }
+        if (isAscii(file.data(), file.size())) {
+            // A binary file with a "solid" header and trailing bytes yields no facets as text
+            if (!readAscii(reinterpret_cast<const char*>(file.data()), file.size(), xyz)) xyz.clear();
+            if (xyz.empty() && binary) readBinary(view, xyz);
+            return !xyz.empty();
+        }
+        return false;
+    }
+
+    // Read into an stl mesh (m_vectors, m_num_triangles)
+    static bool read(const std::string& path, stl& mesh)
+    {
+        std::vector<float> xyz;
+        if (!read(path, xyz)) return false;
+        mesh.m_num_triangles = static_cast<uint32_t>(xyz.size() / 9);
+        mesh.m_vectors = std::move(xyz);
+        return true;
+    }
+
+private:
+    static constexpr size_t kMinBinaryBlock = 1 << 14;     // triangles
+    static constexpr size_t kMinAsciiChunk = 1 << 20;      // bytes
+
+    static void readBinary(const BinaryView& view, std::vector<float>& xyz)
+    {
+        xyz.resize(view.count * 9);
+        const size_t blocks = std::max<size_t>(1, std::min<size_t>(view.count / kMinBinaryBlock,
+            static_cast<size_t>(Parallel::threadCount())));
+        Parallel::forRange(0, static_cast<int>(blocks), [&](int b0, int b1)
+            {
+                size_t t0 = view.count * b0 / blocks, t1 = view.count * b1 / blocks;
+                view.copy(t0, t1 - t0, xyz.data() + t0 * 9);
+            });
+    }
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v'; }
+
+    static bool isAscii(const uint8_t* data, size_t size)
+    {
+        size_t i = 0;
+        while (i < size && isSpace(static_cast<char>(data[i]))) ++i;
+        return size - i >= 5 && std::memcmp(data + i, "solid", 5) == 0;
+    }
+
+    // Start of the first "facet" token at or after pos (not "endfacet"), or size
+    static size_t nextFacet(const char* s, size_t size, size_t pos)
+    {
+        for (; pos + 5 <= size; ++pos) {
+            if (s[pos] == 'f' && std::memcmp(s + pos, "facet", 5) == 0
+                && (pos == 0 || isSpace(s[pos - 1]))
+                && (pos + 5 == size || isSpace(s[pos + 5]))) {
+                return pos;
+            }
+        }
+        return size;
+    }
+
+    static bool parseFloat(const char*& p, const char* end, float& out)
+    {
+        while (p < end && isSpace(*p)) ++p;
+        if (p < end && *p == '+') ++p;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        auto [ptr, ec] = std::from_chars(p, end, out);
+        if (ec != std::errc()) return false;
+        p = ptr;
+#else
+        // The mapping is not NUL terminated; copy the token before strtof
+        char buf[64];
+        size_t n = 0;
+        while (p + n < end && !isSpace(p[n]) && n + 1 < sizeof(buf)) {
+            buf[n] = p[n];
+            ++n;
+        }
+        buf[n] = '\0';
+        char* stop = nullptr;
+        out = std::strtof(buf, &stop);
+        if (stop == buf) return false;
+        p += stop - buf;
+#endif
+        return true;
+    }
+
+    // Calls onVertex(p) at every "vertex" token in [s, end), with p just past the
+    // token; stops and returns false as soon as onVertex does
+    template <typename F>
+    static bool forEachVertex(const char* s, const char* end, F&& onVertex)
+    {
+        const char* p = s;
+        while (p < end) {
+            while (p < end && isSpace(*p)) ++p;
+            const char* token = p;
+            while (p < end && !isSpace(*p)) ++p;
+            if (p - token == 6 && std::memcmp(token, "vertex", 6) == 0) {
+                if (!onVertex(p)) return false;
+            }
+        }
+        return true;
+    }
+
+    // Two passes over the text: count the vertices of each chunk, then parse every
+    // chunk straight into its place in xyz, so the mesh is held only once
+    static bool readAscii(const char* s, size_t size, std::vector<float>& xyz)
+    {
+        // Cut points snapped forward to facet starts, so every chunk holds whole facets
+        const size_t first = nextFacet(s, size, 0);
+        const size_t chunks = std::max<size_t>(1, std::min<size_t>((size - first) / kMinAsciiChunk,
+            static_cast<size_t>(Parallel::threadCount()) * 4));
+        std::vector<size_t> cut(chunks + 1);
+        cut[0] = first;
+        cut[chunks] = size;
+        for (size_t c = 1; c < chunks; ++c) {
+            cut[c] = std::max(cut[c - 1], nextFacet(s, size, first + (size - first) * c / chunks));
+        }
+
+        std::vector<size_t> offset(chunks + 1, 0);
+        Parallel::forRange(0, static_cast<int>(chunks), [&](int c0, int c1)
+            {
+                for (int c = c0; c < c1; ++c) {
+                    size_t n = 0;
+                    forEachVertex(s + cut[c], s + cut[c + 1], [&](const char*&) { ++n; return true; });
+                    offset[c + 1] = n;
+                }
+            });
+        for (size_t c = 0; c < chunks; ++c) {
+            if (offset[c + 1] % 3 != 0) return false;
+            offset[c + 1] += offset[c];
+        }
+
+        xyz.resize(offset[chunks] * 3);
+        std::unique_ptr<bool[]> ok(new bool[chunks]);
+        Parallel::forRange(0, static_cast<int>(chunks), [&](int c0, int c1)
+            {
+                for (int c = c0; c < c1; ++c) {
+                    const char* end = s + cut[c + 1];
+                    float* out = xyz.data() + offset[c] * 3;
+                    float* const stop = xyz.data() + offset[c + 1] * 3;
+                    // Malformed numbers can split tokens differently from the count; never write past the chunk
+                    ok[c] = forEachVertex(s + cut[c], end, [&](const char*& p)
+                        {
+                            if (stop - out < 3) return false;
+                            for (int a = 0; a < 3; ++a) {
+                                if (!parseFloat(p, end, *out++)) return false;
+                            }
+                            return true;
+                        }) && out == stop;
+                }
+            });
+        for (size_t c = 0; c < chunks; ++c) {
+            if (!ok[c]) return false;
+        }
+        return true;
+    }
+};
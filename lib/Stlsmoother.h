@@ -1,66 +1,29 @@
 ﻿// written by Paul Baxter
 #pragma once
 
-#include <unordered_map>
 #include <vector>
 #include <cmath>
+#include <cstdint>
 #include "vec3.h"
 #include "Laplace.h"
+#include "VertexWelder.h"
+#include "IndexedMesh.h"
 #include "stl.h"
 
 using glm::vec3;
-using Tri = glm::vec3;
-
-// --- Deduplication helpers ---
-struct Vec3Hash {
-    size_t operator()(const vec3& v) const noexcept
-    {
-        auto h1 = std::hash<float>()(v.x);
-        auto h2 = std::hash<float>()(v.y);
-        auto h3 = std::hash<float>()(v.z);
-        return h1 ^ (h2 << 1) ^ (h3 << 2);
-    }
-};
-
-struct Vec3Equal {
-    bool operator()(const vec3& a, const vec3& b) const noexcept
-    {
-        return
-            std::fabs(a.x - b.x) < 1e-6 &&
-            std::fabs(a.y - b.y) < 1e-6 &&
-            std::fabs(a.z - b.z) < 1e-6;
-    }
-};
 
 // --- Convert STL -> Mesh ---
+// Coincident corners are welded on a quantized grid (see VertexWelder)
 static void buildMeshFromSTL(const stl& model,
     std::vector<vec3>& V,
     std::vector<Tri>& F)
 {
-    std::unordered_map<vec3, int, Vec3Hash, Vec3Equal> uniqueVerts;
-    V.clear();
-    F.clear();
-
-    for (uint32_t t = 0; t < model.m_num_triangles; ++t) {
-        int idx[3];
-        for (int k = 0; k < 3; ++k) {
-            int base = (t * 9) + (k * 3);
-            vec3 v(model.m_vectors[base + 0],
-                model.m_vectors[base + 1],
-                model.m_vectors[base + 2]);
+    std::vector<uint32_t> remap;
+    VertexWelder::weld(model.m_vectors.data(), static_cast<size_t>(model.m_num_triangles) * 3, V, remap);
 
-            auto it = uniqueVerts.find(v);
-            if (it == uniqueVerts.end()) {
-                int newIdx = (int)V.size();
-                V.push_back(v);
-                uniqueVerts[v] = newIdx;
-                idx[k] = newIdx;
-            }
-            else {
-                idx[k] = it->second;
-            }
-        }
-        F.emplace_back(idx[0], idx[1], idx[2]);
+    F.resize(model.m_num_triangles);
+    for (size_t t = 0; t < F.size(); ++t) {
+        F[t] = Tri(remap[t * 3 + 0], remap[t * 3 + 1], remap[t * 3 + 2]);
     }
 }
 
@@ -81,22 +44,69 @@ static void updateSTLFromMesh(stl& model,
 }
 
 // --- Main smoothing wrapper ---
+enum class SmoothMode {
+    Taubin,     // explicit λ/μ passes, cotan weights
+    Uniform,    // explicit umbrella passes
+    Implicit,   // one backward Euler solve, cotan weights
+};
+
+static void smoothMesh(std::vector<vec3>& V,
+    const std::vector<Tri>& F,
+    int iterations,
+    SmoothMode mode,
+    float lambda)
+{
+    switch (mode) {
+    case SmoothMode::Taubin:
+        // λ/μ smoothing (less shrinkage)
+        taubinCotanSmooth(V, F, iterations, 0.5f, -0.53f, true);
+        break;
+    case SmoothMode::Uniform:
+        // Simple umbrella smoother
+        uniformSmooth(V, F, iterations, 0.4f, true);
+        break;
+    case SmoothMode::Implicit:
+        implicitSmooth(V, F, lambda);
+        break;
+    }
+}
+
+// iterations counts explicit passes; lambda is the implicit step size
 void smoothSTL(stl& model,
     int iterations,
-    bool useTaubin = true) 
+    SmoothMode mode = SmoothMode::Taubin,
+    float lambda = 1.0f)
 {
     std::vector<vec3> V;
     std::vector<Tri> F;
     buildMeshFromSTL(model, V, F);
 
-    if (useTaubin) {
-        // λ/μ smoothing (less shrinkage)
-        taubinCotanSmooth(V, F, iterations, 0.5f, -0.53f, true);
+    smoothMesh(V, F, iterations, mode, lambda);
+
+    updateSTLFromMesh(model, V, F);
+}
+
+// Indexed meshes already share vertices, so no welding is needed
+void smoothIndexed(IndexedMesh& mesh,
+    int iterations,
+    SmoothMode mode = SmoothMode::Taubin,
+    float lambda = 1.0f)
+{
+    const size_t nv = mesh.vertexCount();
+    std::vector<vec3> V(nv);
+    for (size_t i = 0; i < nv; ++i) {
+        V[i] = vec3(mesh.positions[i * 3 + 0], mesh.positions[i * 3 + 1], mesh.positions[i * 3 + 2]);
     }
-    else {
-        // Simple umbrella smoother
-        uniformSmooth(V, F, iterations, 0.4f, true);
+    std::vector<Tri> F(mesh.triangleCount());
+    for (size_t t = 0; t < F.size(); ++t) {
+        F[t] = Tri(mesh.indices[t * 3 + 0], mesh.indices[t * 3 + 1], mesh.indices[t * 3 + 2]);
     }
 
-    updateSTLFromMesh(model, V, F);
+    smoothMesh(V, F, iterations, mode, lambda);
+
+    for (size_t i = 0; i < nv; ++i) {
+        mesh.positions[i * 3 + 0] = V[i].x;
+        mesh.positions[i * 3 + 1] = V[i].y;
+        mesh.positions[i * 3 + 2] = V[i].z;
+    }
 }
@@ -0,0 +1,177 @@
+// written by Paul Baxter
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+#include <cstdint>
+
+#include "TextureSampler.h"
+#include "Stats.h"
+
+// A decoded RGB texture plus its mip pyramid, shared read-only between renders
+struct DecodedTexture {
+    TextureImage image;
+    std::vector<TextureSampler::MipLevel> mips;
+
+    TextureView view() const { return image.view(); }
+
+    size_t bytes() const
+    {
+        size_t n = image.bytes();
+        for (const auto& m : mips) n += m.data.size();
+        return n;
+    }
+};
+
+/// <summary>
+/// Process-wide LRU cache of decoded textures, keyed by canonical path,
+/// modification time and file size, so an edited file is decoded again.
+/// Entries are evicted least recently used first once the byte budget is exceeded.
+/// Thread safe; decoding happens outside the lock.
+/// </summary>
+class TextureCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+    };
+
+    static TextureCache& instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    /// <summary>
+    /// Return the decoded texture for path, decoding and building mips on a miss.
+    /// Returns nullptr if the file cannot be read or decoded.
+    /// </summary>
+    std::shared_ptr<const DecodedTexture> load(const std::string& path)
+    {
+        std::error_code ec;
+        std::filesystem::path canonical = std::filesystem::canonical(path, ec);
+        if (ec) return nullptr;
+        auto size = std::filesystem::file_size(canonical, ec);
+        if (ec) return nullptr;
+        auto mtime = std::filesystem::last_write_time(canonical, ec);
+        if (ec) return nullptr;
+
+        const std::string file = canonical.string();
+        const std::string key = file + '|' + std::to_string(mtime.time_since_epoch().count()) + '|' + std::to_string(size);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                lru.splice(lru.begin(), lru, it->second);
+                ++stats_.hits;
+                STATS_ADD(CacheHits, 1);
+                return it->second->texture;
+            }
+            ++stats_.misses;
+            STATS_ADD(CacheMisses, 1);
+        }
+
+        auto decoded = std::make_shared<DecodedTexture>();
+        decoded->image = TextureImage::load(file);
+        if (decoded->image.empty()) {
+            return nullptr;
+        }
+        decoded->mips = TextureSampler::buildMipChain(decoded->image.view());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(key, file, decoded);
+        return decoded;
+    }
+
+    void setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s = stats_;
+        s.entries = lru.size();
+        s.bytes = used;
+        s.budget = budget;
+        return s;
+    }
+
+    size_t hits() const { return stats().hits; }
+    size_t misses() const { return stats().misses; }
+
+private:
+    struct Entry {
+        std::string key;
+        std::string file;
+        std::shared_ptr<const DecodedTexture> texture;
+        size_t bytes = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Entry> lru;       // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t budget = size_t(512) << 20;
+    size_t used = 0;
+    Stats stats_;
+
+    TextureCache() = default;
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    void insert(const std::string& key, const std::string& file, std::shared_ptr<const DecodedTexture> texture)
+    {
+        // Another thread may have decoded the same file meanwhile
+        if (index.count(key)) return;
+
+        // Drop stale versions of the same file
+        for (auto it = lru.begin(); it != lru.end();) {
+            if (it->file == file) {
+                used -= it->bytes;
+                index.erase(it->key);
+                it = lru.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        size_t bytes = texture->bytes();
+        if (bytes > budget) return;     // too large to keep, caller still gets it
+
+        lru.push_front({ key, file, std::move(texture), bytes });
+        index[key] = lru.begin();
+        used += bytes;
+        evict();
+    }
+
+    void evict()
+    {
+        while (used > budget && !lru.empty()) {
+            used -= lru.back().bytes;
+            index.erase(lru.back().key);
+            lru.pop_back();
+            ++stats_.evictions;
+        }
+    }
+};
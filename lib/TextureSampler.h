@@ -5,15 +5,246 @@
 #include <string>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <memory>
+#include <filesystem>
 
 #include "stb_image.h"
+#include "Parallel.h"
+#include "MappedFile.h"
+
+// Non-owning view of 8 bit interleaved pixels, rows packed w * channels bytes apart
+struct TextureView {
+    const uint8_t* data = nullptr;
+    int w = 0;
+    int h = 0;
+    int channels = 0;
+
+    bool empty() const { return !data || w <= 0 || h <= 0 || channels < 3; }
+    const uint8_t* row(int y) const { return data + static_cast<size_t>(y) * w * channels; }
+};
+
+/// <summary>
+/// Owning texture pixels without a copy: either the stbi allocation adopted as is,
+/// or a memory mapped binary PPM whose pixel block is used in place.
+/// Cheap to copy (shared ownership).
+/// </summary>
+class TextureImage {
+public:
+    /// <summary>
+    /// Load path as 3 channel pixels. Returns an empty image on failure.
+    /// </summary>
+    static TextureImage load(const std::string& path)
+    {
+        TextureImage img;
+        std::string ext = std::filesystem::path(path).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if ((ext == ".ppm" || ext == ".pnm") && mapPPM(path, img)) {
+            return img;
+        }
+
+        int w = 0, h = 0, orig_ch = 0;
+        unsigned char* data = stbi_load(path.c_str(), &w, &h, &orig_ch, 3);
+        if (!data) return img;
+
+        img.owner = std::shared_ptr<const void>(data, [](const void* p) { stbi_image_free(const_cast<void*>(p)); });
+        img.pixels = data;
+        img.w = w;
+        img.h = h;
+        img.channels = 3;
+        return img;
+    }
+
+    TextureView view() const { return { pixels, w, h, channels }; }
+    bool empty() const { return pixels == nullptr; }
+    bool isMapped() const { return mapped; }
+    size_t bytes() const { return static_cast<size_t>(w) * h * channels; }
+
+private:
+    std::shared_ptr<const void> owner;
+    const uint8_t* pixels = nullptr;
+    int w = 0;
+    int h = 0;
+    int channels = 0;
+    bool mapped = false;
+
+    static constexpr int kMaxField = 1 << 24;   // header numbers beyond this are not a texture we map
+
+    // Binary P6 with maxval 255: the pixel block follows the header verbatim
+    static bool mapPPM(const std::string& path, TextureImage& img)
+    {
+        auto file = std::make_shared<MappedFile>(path);
+        if (!file->isOpen()) return false;
+
+        const uint8_t* p = file->data();
+        const uint8_t* end = p + file->size();
+        if (file->size() < 2 || p[0] != 'P' || p[1] != '6') return false;
+        p += 2;
+
+        int fields[3] = {};
+        for (int& f : fields) {
+            // Skip whitespace and comments
+            while (p < end && (std::isspace(*p) || *p == '#')) {
+                if (*p == '#') while (p < end && *p != '\n') ++p;
+                else ++p;
+            }
+            if (p >= end || !std::isdigit(*p)) return false;
+            while (p < end && std::isdigit(*p)) {
+                f = f * 10 + (*p++ - '0');
+                if (f > kMaxField) return false;
+            }
+        }
+        if (p >= end || !std::isspace(*p)) return false;
+        ++p;    // exactly one whitespace before the pixels
+
+        const int w = fields[0], h = fields[1];
+        if (w <= 0 || h <= 0 || fields[2] != 255) return false;
+        if (static_cast<size_t>(end - p) < static_cast<size_t>(w) * h * 3) return false;
+
+        img.pixels = p;
+        img.owner = std::move(file);
+        img.w = w;
+        img.h = h;
+        img.channels = 3;
+        img.mapped = true;
+        return true;
+    }
+};
 
 class TextureSampler {
 public:
-    static std::array<uint8_t, 3> sampleBilinear(const std::vector<uint8_t>& texture,
-        int tw, int th, int tchan,
+    /// <summary>
+    /// Batch bilinear sampler for a texture stretched (or tiled) over an output image.
+    /// Column taps and weights are computed once at construction, the vertical blend
+    /// of the two source rows once per output row, so sampling a run of pixels is a
+    /// table lookup and two 8.8 fixed point lerps. Brightness/contrast go through a LUT.
+    /// </summary>
+    class RowSampler {
+    public:
+        RowSampler(const TextureView& texture, int outWidth, int outHeight,
+            bool tiled, float brightness = 1.0f, float contrast = 1.0f)
+            : tex(texture.data), tw(texture.w), th(texture.h), tchan(texture.channels), outHeight(outHeight), tiled(tiled)
+        {
+            ok = !texture.empty() && outWidth > 0 && outHeight > 0;
+            if (!ok) return;
+
+            // Same texel mapping as sampleBilinear / sampleBilinearTiled
+            const float sx = static_cast<float>(tw) / outWidth;
+            cols.resize(outWidth);
+            for (int x = 0; x < outWidth; ++x) {
+                int x0, x1;
+                float fx;
+                axis(static_cast<float>(x) * sx, tw, x0, x1, fx);
+                cols[x] = { static_cast<uint32_t>(x0) * 3, static_cast<uint32_t>(x1) * 3, weight(fx) };
+            }
+
+            for (int v = 0; v < 256; ++v) {
+                float val = v / 255.0f;
+                val = ((val - 0.5f) * contrast) + 0.5f;
+                val *= brightness;
+                lut[v] = static_cast<uint8_t>(std::clamp(val * 255.0f, 0.0f, 255.0f));
+            }
+
+            blended.resize(static_cast<size_t>(tw) * 3);
+        }
+
+        /// <summary>
+        /// Sample count output pixels starting at (x0, y).
+        /// </summary>
+        void sampleRow(int y, int x0, int count, std::array<uint8_t, 3>* out)
+        {
+            if (!ok) {
+                for (int i = 0; i < count; ++i) out[i] = { 128, 128, 128 };
+                return;
+            }
+            if (y != cachedRow) blendRow(y);
+
+            const uint16_t* v = blended.data();
+            for (int i = 0; i < count; ++i) {
+                const Column& col = cols[x0 + i];
+                const uint32_t wx1 = col.fx;
+                const uint32_t wx0 = 256 - wx1;
+                for (int c = 0; c < 3; ++c) {
+                    uint32_t val = (v[col.x0 + c] * wx0 + v[col.x1 + c] * wx1) >> 16;
+                    out[i][c] = lut[val];
+                }
+            }
+        }
+
+    private:
+        struct Column {
+            uint32_t x0;    // offsets into the blended row
+            uint32_t x1;
+            uint16_t fx;    // 8.8 weight of x1
+        };
+
+        const uint8_t* tex;
+        int tw, th, tchan;
+        int outHeight;
+        bool tiled;
+        bool ok = false;
+
+        std::vector<Column> cols;
+        std::array<uint8_t, 256> lut{};
+        std::vector<uint16_t> blended;      // 8.8 vertical blend of the current row, 3 channels per texel
+        int cachedRow = -1;
+
+        static uint16_t weight(float f)
+        {
+            return static_cast<uint16_t>(std::clamp(static_cast<int>(f * 256.0f + 0.5f), 0, 256));
+        }
+
+        void axis(float t, int size, int& i0, int& i1, float& f) const
+        {
+            if (tiled) {
+                t = std::fmod(t, static_cast<float>(size));
+                if (t < 0) t += size;
+                i0 = std::min(static_cast<int>(t), size - 1);
+                f = t - i0;
+                i1 = i0 + 1 == size ? 0 : i0 + 1;
+            }
+            else {
+                t = std::clamp(t, 0.0f, static_cast<float>(size - 1));
+                i0 = static_cast<int>(t);
+                f = t - i0;
+                i1 = std::min(i0 + 1, size - 1);
+            }
+        }
+
+        void blendRow(int y)
+        {
+            int y0, y1;
+            float fy;
+            axis(static_cast<float>(y) * (static_cast<float>(th) / outHeight), th, y0, y1, fy);
+            const uint32_t wy1 = weight(fy);
+            const uint32_t wy0 = 256 - wy1;
+
+            const uint8_t* r0 = tex + static_cast<size_t>(y0) * tw * tchan;
+            const uint8_t* r1 = tex + static_cast<size_t>(y1) * tw * tchan;
+            uint16_t* dst = blended.data();
+            if (tchan == 3) {
+                const size_t n = static_cast<size_t>(tw) * 3;
+                for (size_t i = 0; i < n; ++i) {
+                    dst[i] = static_cast<uint16_t>(r0[i] * wy0 + r1[i] * wy1);
+                }
+            }
+            else {
+                for (int x = 0; x < tw; ++x) {
+                    for (int c = 0; c < 3; ++c) {
+                        dst[x * 3 + c] = static_cast<uint16_t>(r0[x * tchan + c] * wy0 + r1[x * tchan + c] * wy1);
+                    }
+                }
+            }
+            cachedRow = y;
+        }
+    };
+
+    static std::array<uint8_t, 3> sampleBilinear(const TextureView& texture,
         float texX, float texY)
     {
+        const int tw = texture.w, th = texture.h, tchan = texture.channels;
         // REMOVE modulo wrapping - rely on the clamping from the caller
         // Just ensure coordinates are within bounds for safety
         texX = std::clamp(texX, 0.0f, static_cast<float>(tw - 1));
@@ -37,7 +268,7 @@ public:
                 // Add bounds checking for extra safety
                 x = std::clamp(x, 0, tw - 1);
                 y = std::clamp(y, 0, th - 1);
-                return static_cast<float>(texture[(y * tw + x) * tchan + c]);
+                return static_cast<float>(texture.data[(y * tw + x) * tchan + c]);
             };
 
         std::array<uint8_t, 3> color{ 0, 0, 0 };
@@ -58,10 +289,10 @@ public:
     }
 
     // Alternative: If you want tiling behavior but without edge artifacts, use this version:
-    static std::array<uint8_t, 3> sampleBilinearTiled(const std::vector<uint8_t>& texture,
-        int tw, int th, int tchan,
+    static std::array<uint8_t, 3> sampleBilinearTiled(const TextureView& texture,
         float texX, float texY)
     {
+        const int tw = texture.w, th = texture.h, tchan = texture.channels;
         // For tiling textures, use repeat mode but handle edges carefully
         texX = std::fmod(texX, static_cast<float>(tw));
         if (texX < 0) texX += tw;
@@ -78,7 +309,7 @@ public:
 
         auto getTexel = [&](int x, int y, int c) -> float
             {
-                return static_cast<float>(texture[(y * tw + x) * tchan + c]);
+                return static_cast<float>(texture.data[(y * tw + x) * tchan + c]);
             };
 
         std::array<uint8_t, 3> color{ 0, 0, 0 };
@@ -97,19 +328,70 @@ public:
         return color;
     }
 
+    // One downsampled copy of a texture, always 3 channels
+    struct MipLevel {
+        std::vector<uint8_t> data;
+        int w = 0;
+        int h = 0;
+
+        TextureView view() const { return { data.data(), w, h, 3 }; }
+    };
+
     /// <summary>
-    /// Load a file into a 3 channel vector
+    /// Build the 2x2 box filtered pyramid below a texture: level i is
+    /// (tw >> (i + 1)) x (th >> (i + 1)), down to a 1 pixel side.
+    /// The base image itself is not copied. Rows are filtered in parallel.
     /// </summary>
-    static bool loadRGB(const std::string& path, std::vector<uint8_t>& out,
-        int& w, int& h, int& channels)
+    static std::vector<MipLevel> buildMipChain(const TextureView& texture)
     {
-        int orig_ch = 0;
-        unsigned char* data = stbi_load(path.c_str(), &w, &h, &orig_ch, 3);
-        if (!data) return false;
+        std::vector<MipLevel> chain;
+        if (texture.empty()) return chain;
 
-        channels = 3;
-        out.assign(data, data + (w * h * channels));
-        stbi_image_free(data);
-        return true;
+        const uint8_t* src = texture.data;
+        int sw = texture.w, sh = texture.h, sc = texture.channels;
+        while (sw > 1 && sh > 1) {
+            MipLevel level;
+            level.w = sw / 2;
+            level.h = sh / 2;
+            level.data.resize(static_cast<size_t>(level.w) * level.h * 3);
+
+            uint8_t* dst = level.data.data();
+            const int lw = level.w;
+            Parallel::forRange(0, level.h, [&](int y0, int y1)
+                {
+                    for (int y = y0; y < y1; ++y) {
+                        const uint8_t* r0 = src + static_cast<size_t>(2 * y) * sw * sc;
+                        const uint8_t* r1 = r0 + static_cast<size_t>(sw) * sc;
+                        uint8_t* out = dst + static_cast<size_t>(y) * lw * 3;
+                        for (int x = 0; x < lw; ++x) {
+                            const int a = 2 * x * sc;
+                            const int b = a + sc;
+                            for (int c = 0; c < 3; ++c) {
+                                out[x * 3 + c] = static_cast<uint8_t>((r0[a + c] + r0[b + c] + r1[a + c] + r1[b + c] + 2) >> 2);
+                            }
+                        }
+                    }
+                }, 16);
+
+            chain.push_back(std::move(level));
+            src = chain.back().data.data();
+            sw = chain.back().w;
+            sh = chain.back().h;
+            sc = 3;
+        }
+        return chain;
+    }
+
+    /// <summary>
+    /// Pick the pyramid level whose size best matches the output: 0 is the
+    /// base texture, n is chain[n - 1]. Never minifies by more than 2x per axis
+    /// after the level is chosen, so bilinear sampling stays local.
+    /// </summary>
+    static int selectMipLevel(int tw, int th, int outWidth, int outHeight, int levels)
+    {
+        if (outWidth <= 0 || outHeight <= 0) return 0;
+        float ratio = std::min(static_cast<float>(tw) / outWidth, static_cast<float>(th) / outHeight);
+        if (ratio < 2.0f) return 0;
+        return std::min(static_cast<int>(std::floor(std::log2(ratio))), levels);
     }
 };
\ No newline at end of file
@@ -0,0 +1,363 @@
+// written by Paul Baxter
+#pragma once
+#include <thread>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <algorithm>
+
+/// <summary>
+/// Process-wide work-stealing thread pool shared by every pipeline stage.
+/// Each worker owns a deque: it pushes and pops its own tasks at the back and
+/// steals from the front of the others; threads outside the pool submit to a
+/// shared queue. A thread waiting for a group (parallelFor, TaskGroup::wait)
+/// runs that group's queued tasks meanwhile, so nested loops and several
+/// renders in one process share the same threads instead of each spawning
+/// their own. Waiters run only their own group's tasks, never unrelated work
+/// that might block on something the waiter holds (a lock, a static being
+/// initialized): each task is queued both in the pool and in its group, and
+/// whichever side claims it first runs it.
+/// </summary>
+class ThreadPool {
+public:
+    class TaskGroup;
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group = nullptr;
+        std::atomic<bool> claimed{ false };
+    };
+
+public:
+    static ThreadPool& instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static int hardwareThreads()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : static_cast<int>(n);
+    }
+
+    // Threads that run work, counting the calling thread (at least 1)
+    int threadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Use n threads, 0 = one per hardware thread. Call between renders, while no
+    // work is queued or running.
+    void setThreadCount(int n)
+    {
+        if (n <= 0) n = hardwareThreads();
+        if (n == threadCount()) return;
+        stop();
+        start(n);
+    }
+
+    /// <summary>
+    /// Fork-join set of tasks. wait() runs the group's queued tasks until all of the
+    /// group have finished, then rethrows the first exception any of them threw;
+    /// tasks not yet started when one fails are skipped.
+    /// </summary>
+    class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool& pool = ThreadPool::instance()) : pool(pool) {}
+        ~TaskGroup()
+        {
+            // Tasks may reference the caller's stack; never leave them running
+            try { wait(); }
+            catch (...) {}
+        }
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        template <typename F>
+        void run(F&& fn)
+        {
+            auto task = std::make_shared<Task>();
+            task->group = this;
+            task->fn = [this, fn = std::forward<F>(fn)]() mutable
+                {
+                    if (!failed.load(std::memory_order_relaxed)) {
+                        try { fn(); }
+                        catch (...) { fail(std::current_exception()); }
+                    }
+                    finish();
+                };
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++outstanding;
+                ++pending;
+                tasks.push_back(task);
+            }
+            pool.push(std::move(task));
+            // A waiter asleep in wait() can run it
+            changed.notify_all();
+        }
+
+        void wait()
+        {
+            for (;;) {
+                if (pool.runOne(this)) continue;
+                std::unique_lock<std::mutex> lock(mutex);
+                // Woken when the group finishes or gets a task nobody has claimed yet
+                changed.wait(lock, [&]() { return outstanding == 0 || pending > 0; });
+                if (outstanding == 0) break;
+            }
+            if (error) {
+                std::exception_ptr e = error;
+                error = nullptr;
+                failed = false;
+                std::rethrow_exception(e);
+            }
+        }
+
+    private:
+        friend class ThreadPool;
+
+        ThreadPool& pool;
+        std::mutex mutex;
+        std::condition_variable changed;
+        int outstanding = 0;                            // run, not yet finished
+        std::atomic<int> pending{ 0 };                  // run, not yet claimed
+        std::vector<std::shared_ptr<Task>> tasks;       // newest last; claimed ones are dropped lazily
+        std::atomic<bool> failed{ false };
+        std::exception_ptr error;
+
+        // Claim the newest unclaimed task of the group
+        std::shared_ptr<Task> take()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!tasks.empty()) {
+                std::shared_ptr<Task> task = std::move(tasks.back());
+                tasks.pop_back();
+                if (pool.claim(*task)) return task;
+            }
+            return nullptr;
+        }
+
+        void fail(std::exception_ptr e)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = e;
+            failed = true;
+        }
+
+        void finish()
+        {
+            // Notify under the lock: once outstanding reaches 0 the waiter may destroy the group
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--outstanding == 0) changed.notify_all();
+        }
+    };
+
+    /// <summary>
+    /// Tasks with dependencies: add returns a node id, run starts every node once
+    /// all the nodes it depends on have finished, and returns when all are done.
+    /// Exceptions propagate as in TaskGroup.
+    /// </summary>
+    class TaskGraph {
+    public:
+        explicit TaskGraph(ThreadPool& pool = ThreadPool::instance()) : pool(pool) {}
+
+        int add(std::function<void()> fn, std::initializer_list<int> deps = {})
+        {
+            const int id = static_cast<int>(nodes.size());
+            nodes.push_back(std::make_unique<Node>());
+            nodes.back()->fn = std::move(fn);
+            for (int d : deps) {
+                nodes[d]->dependents.push_back(id);
+                ++nodes.back()->deps;
+            }
+            return id;
+        }
+
+        void run()
+        {
+            TaskGroup group(pool);
+            for (auto& n : nodes) n->remaining = n->deps;
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                if (nodes[i]->deps == 0) schedule(group, static_cast<int>(i));
+            }
+            group.wait();
+        }
+
+    private:
+        struct Node {
+            std::function<void()> fn;
+            std::vector<int> dependents;
+            int deps = 0;
+            std::atomic<int> remaining{ 0 };
+        };
+
+        ThreadPool& pool;
+        std::vector<std::unique_ptr<Node>> nodes;
+
+        void schedule(TaskGroup& group, int id)
+        {
+            group.run([this, &group, id]()
+                {
+                    nodes[id]->fn();
+                    for (int d : nodes[id]->dependents) {
+                        if (nodes[d]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) schedule(group, d);
+                    }
+                });
+        }
+    };
+
+    /// <summary>
+    /// Split [begin, end) into contiguous blocks of at least minBlock items and
+    /// call fn(blockBegin, blockEnd) for each. There are a few blocks per thread
+    /// so idle threads can steal the tail; the caller runs the last block.
+    /// </summary>
+    template <typename F>
+    void parallelFor(int begin, int end, F&& fn, int minBlock = 1)
+    {
+        const int n = end - begin;
+        if (n <= 0) return;
+
+        const int blocks = std::clamp(n / std::max(1, minBlock), 1, threadCount() * kBlocksPerThread);
+        if (blocks == 1 || threadCount() == 1) {
+            fn(begin, end);
+            return;
+        }
+
+        auto bound = [&](int b) { return begin + static_cast<int>(static_cast<long long>(n) * b / blocks); };
+        TaskGroup group(*this);
+        for (int b = 0; b < blocks - 1; ++b) {
+            group.run([&fn, b0 = bound(b), b1 = bound(b + 1)]() { fn(b0, b1); });
+        }
+        fn(bound(blocks - 1), end);
+        group.wait();
+    }
+
+    ~ThreadPool() { stop(); }
+
+private:
+    static constexpr int kBlocksPerThread = 4;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Task>> tasks;
+    };
+
+    // Worker i owns queues[i]; the last queue takes tasks from outside the pool
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    inline static thread_local ThreadPool* tlsPool = nullptr;
+    inline static thread_local int tlsIndex = -1;
+
+    ThreadPool() { start(hardwareThreads()); }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void start(int threads)
+    {
+        const int n = std::max(1, threads) - 1;
+        queues.clear();
+        for (int i = 0; i <= n; ++i) queues.push_back(std::make_unique<Queue>());
+        workers.reserve(n);
+        for (int i = 0; i < n; ++i) workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+        workers.clear();
+        stopping = false;
+    }
+
+    void workerLoop(int index)
+    {
+        tlsPool = this;
+        tlsIndex = index;
+        for (;;) {
+            if (runOne(nullptr)) continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [&]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            if (stopping && queued.load(std::memory_order_acquire) == 0) break;
+        }
+        tlsPool = nullptr;
+        tlsIndex = -1;
+    }
+
+    int ownQueue() const { return tlsPool == this ? tlsIndex : static_cast<int>(queues.size()) - 1; }
+
+    void push(std::shared_ptr<Task> task)
+    {
+        Queue& q = *queues[ownQueue()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            // Tasks their group's waiter already ran are dropped once they reach an end
+            while (!q.tasks.empty() && q.tasks.front()->claimed.load(std::memory_order_relaxed)) q.tasks.pop_front();
+            while (!q.tasks.empty() && q.tasks.back()->claimed.load(std::memory_order_relaxed)) q.tasks.pop_back();
+            q.tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            // Pairs with the predicate check in workerLoop, so the wakeup is not lost
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // First caller wins: the pool (a worker) or the task's group (its waiter)
+    bool claim(Task& task)
+    {
+        if (task.claimed.exchange(true, std::memory_order_acq_rel)) return false;
+        queued.fetch_sub(1, std::memory_order_acq_rel);
+        task.group->pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Run one queued task of group (any task if null) on the calling thread; false if there was none
+    bool runOne(TaskGroup* group)
+    {
+        std::shared_ptr<Task> task = group ? group->take() : pop();
+        if (!task) return false;
+        task->fn();
+        return true;
+    }
+
+    // Own queue newest first, then the others oldest first
+    std::shared_ptr<Task> pop()
+    {
+        if (queued.load(std::memory_order_acquire) == 0) return nullptr;
+
+        const int self = ownQueue();
+        const int n = static_cast<int>(queues.size());
+        for (int k = 0; k < n; ++k) {
+            Queue& q = *queues[(self + k) % n];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            while (!q.tasks.empty()) {
+                std::shared_ptr<Task> task;
+                if (k == 0) {
+                    task = std::move(q.tasks.back());
+                    q.tasks.pop_back();
+                }
+                else {
+                    task = std::move(q.tasks.front());
+                    q.tasks.pop_front();
+                }
+                if (claim(*task)) return task;
+            }
+        }
+        return nullptr;
+    }
+};
@@ -0,0 +1,136 @@
+// written by Paul Baxter
+#pragma once
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <memory>
+
+#include "vec3.h"
+#include "Parallel.h"
+#include "RadixSort.h"
+
+class VertexWelder {
+public:
+    static constexpr int kAxisBits = 21;    // 3 x 21 bits fit one 64 bit key
+
+    /// <summary>
+    /// Merge coincident positions of a triangle soup (xyz triples, count positions).
+    /// Positions are quantized to a 2^21 grid per axis over their bounds, the
+    /// (key, index) pairs are radix sorted, and every run of equal keys becomes one
+    /// vertex. Keys are mixed before sorting since only grouping matters and
+    /// mixed keys partition evenly. Vertices are numbered in order of first occurrence, so the result
+    /// does not depend on thread count. remap[i] is the vertex of position i.
+    /// </summary>
+    static void weld(const float* xyz, size_t count,
+        std::vector<glm::vec3>& V, std::vector<uint32_t>& remap)
+    {
+        V.clear();
+        remap.clear();
+        if (count == 0) return;
+
+        // Bounds
+        const int blocks = std::max(1, std::min(Parallel::threadCount() * 4, static_cast<int>(count / 65536) + 1));
+        std::vector<std::array<float, 6>> partial(blocks);
+        auto blockBegin = [&](int b) { return static_cast<size_t>(static_cast<unsigned long long>(count) * b / blocks); };
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    std::array<float, 6> bb = { INF, INF, INF, -INF, -INF, -INF };
+                    for (size_t i = blockBegin(b), e = blockBegin(b + 1); i < e; ++i) {
+                        for (int a = 0; a < 3; ++a) {
+                            bb[a] = std::min(bb[a], xyz[i * 3 + a]);
+                            bb[a + 3] = std::max(bb[a + 3], xyz[i * 3 + a]);
+                        }
+                    }
+                    partial[b] = bb;
+                }
+            });
+        float lo[3] = { INF, INF, INF };
+        float scale[3];
+        for (int a = 0; a < 3; ++a) {
+            float hi = -INF;
+            for (const auto& bb : partial) {
+                lo[a] = std::min(lo[a], bb[a]);
+                hi = std::max(hi, bb[a + 3]);
+            }
+            float extent = hi - lo[a];
+            scale[a] = extent > 0.0f ? static_cast<float>((1u << kAxisBits) - 1) / extent : 0.0f;
+        }
+
+        // Grid keys
+        // Work buffers stay uninitialized so the parallel passes do the first touch
+        std::unique_ptr<uint64_t[]> keys(new uint64_t[count]);
+        std::unique_ptr<uint32_t[]> order(new uint32_t[count]);
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (size_t i = blockBegin(b0), e = blockBegin(b1); i < e; ++i) {
+                    uint64_t key = 0;
+                    for (int a = 0; a < 3; ++a) {
+                        float v = xyz[i * 3 + a];
+                        float f = (v - lo[a]) * scale[a] + 0.5f;
+                        uint64_t q = f >= 0.0f ? static_cast<uint64_t>(std::min(f, kMaxQ)) : 0;   // NaN -> 0
+                        key |= q << (a * kAxisBits);
+                    }
+                    keys[i] = RadixSort::mixKey(key);
+                    order[i] = static_cast<uint32_t>(i);
+                }
+            });
+
+        RadixSort::sortPairs(keys.get(), order.get(), count);
+
+        // Representative of each run = its smallest index (the sort is stable)
+        std::unique_ptr<uint32_t[]> rep(new uint32_t[count]);
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                size_t s0 = blockBegin(b0), s1 = blockBegin(b1);
+                size_t start = s0;
+                while (start > 0 && keys[start - 1] == keys[s0]) --start;
+                for (size_t s = s0; s < s1; ++s) {
+                    if (keys[s] != keys[start]) start = s;
+                    rep[order[s]] = order[start];
+                }
+            });
+
+        // Number representatives in input order: per block counts, then offsets
+        std::vector<uint32_t> firstCount(blocks + 1, 0);
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    uint32_t c = 0;
+                    for (size_t i = blockBegin(b), e = blockBegin(b + 1); i < e; ++i) c += rep[i] == i;
+                    firstCount[b + 1] = c;
+                }
+            });
+        for (int b = 0; b < blocks; ++b) firstCount[b + 1] += firstCount[b];
+
+        V.resize(firstCount[blocks]);
+        remap.resize(count);
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    uint32_t id = firstCount[b];
+                    for (size_t i = blockBegin(b), e = blockBegin(b + 1); i < e; ++i) {
+                        if (rep[i] == i) {
+                            V[id] = glm::vec3(xyz[i * 3 + 0], xyz[i * 3 + 1], xyz[i * 3 + 2]);
+                            remap[i] = id++;
+                        }
+                    }
+                }
+            });
+        // rep[i] <= i, and representatives were numbered above
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (size_t i = blockBegin(b0), e = blockBegin(b1); i < e; ++i) {
+                    if (rep[i] != i) remap[i] = remap[rep[i]];
+                }
+            });
+    }
+
+private:
+    static constexpr float INF = std::numeric_limits<float>::infinity();
+    static constexpr float kMaxQ = static_cast<float>((1u << kAxisBits) - 1);
+};
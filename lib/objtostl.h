@@ -3,49 +3,55 @@
 
 #include <rapidobj/rapidobj.hpp>
 #include <stl.h>
-#include <array>
+
+#include "IndexedMesh.h"
 
 class OBJToSTL {
 public:
-    static bool convert(const std::string& objfile, stl& mesh)
+    // Load an OBJ as an indexed mesh, keeping rapidobj's shared positions
+    static bool load(const std::string& objfile, IndexedMesh& mesh)
     {
-        rapidobj::Load policy = rapidobj::Load::Optional;        
+        rapidobj::Load policy = rapidobj::Load::Optional;
         auto result = rapidobj::ParseFile(objfile, rapidobj::MaterialLibrary::Default(policy));
         if (result.error) {
             return false;
         }
         rapidobj::Triangulate(result);
 
-        // Clear STL
-        mesh.m_vectors.clear();
-        mesh.m_num_triangles = 0;
-
-        for (auto& shape : result.shapes) {
-            auto& meshobj = shape.mesh;
-            for (size_t i = 0; i < meshobj.indices.size(); i += 3) {
-                auto i1 = meshobj.indices[i + 0].position_index;
-                auto i2 = meshobj.indices[i + 1].position_index;
-                auto i3 = meshobj.indices[i + 2].position_index;
-
-                std::array<float, 9> tri = {
-                    result.attributes.positions[i1 * 3 + 0],
-                    result.attributes.positions[i1 * 3 + 1],
-                    result.attributes.positions[i1 * 3 + 2],
-
-                    result.attributes.positions[i2 * 3 + 0],
-                    result.attributes.positions[i2 * 3 + 1],
-                    result.attributes.positions[i2 * 3 + 2],
-
-                    result.attributes.positions[i3 * 3 + 0],
-                    result.attributes.positions[i3 * 3 + 1],
-                    result.attributes.positions[i3 * 3 + 2]
-                };
-
-                mesh.m_vectors.insert(mesh.m_vectors.end(), tri.begin(), tri.end());
-                mesh.m_num_triangles++;
+        const auto& positions = result.attributes.positions;
+        mesh.positions.assign(positions.data(), positions.data() + positions.size());
+
+        size_t total = 0;
+        for (const auto& shape : result.shapes) {
+            total += shape.mesh.indices.size();
+        }
+        mesh.indices.clear();
+        mesh.indices.reserve(total);
+
+        const size_t nverts = mesh.vertexCount();
+        for (const auto& shape : result.shapes) {
+            const auto& indices = shape.mesh.indices;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                for (int k = 0; k < 3; ++k) {
+                    auto p = indices[i + k].position_index;
+                    if (p < 0 || static_cast<size_t>(p) >= nverts) {
+                        return false;
+                    }
+                    mesh.indices.push_back(static_cast<uint32_t>(p));
+                }
             }
         }
 
         return true;
     }
+
+    static bool convert(const std::string& objfile, stl& mesh)
+    {
+        IndexedMesh indexed;
+        if (!load(objfile, indexed)) {
+            return false;
+        }
+        indexed.toSoup(mesh);
+        return true;
+    }
 };
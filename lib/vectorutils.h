@@ -2,8 +2,12 @@
 // Written by Paul Baxter (revised)
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <vector>
 #include <algorithm>
 #include "vec3.h"
+#include "Parallel.h"
 
 
 class vectorutils {
@@ -83,6 +87,59 @@ public:
         }
     }
 
+    // scale, shear_mesh, rotateQuaternion (about the origin) and translate, composed in that order
+    static glm::mat4 composeTransform(const glm::vec3& sc, const glm::vec3& shear, const glm::vec3& rot_deg, const glm::vec3& trans)
+    {
+        glm::mat4 scaleMat(1.0f);
+        scaleMat[0][0] = sc.x;
+        scaleMat[1][1] = sc.y;
+        scaleMat[2][2] = sc.z;
+
+        glm::mat4 shearMat(1.0f);
+        shearMat[1][0] = shear.x;
+        shearMat[2][0] = shear.y;
+        shearMat[2][1] = shear.z;
+
+        glm::quat rotation = glm::quat(glm::vec3(glm::radians(rot_deg.x), glm::radians(rot_deg.y), glm::radians(rot_deg.z)));
+        glm::mat4 translation = glm::translate(glm::mat4(1.0f), trans);
+
+        return translation * glm::toMat4(rotation) * shearMat * scaleMat;
+    }
+
+    // Bounds of a point set, plus its extent along an optional direction
+    struct Extents {
+        float lo[3] = { INF, INF, INF };
+        float hi[3] = { -INF, -INF, -INF };
+        float dlo = INF;
+        float dhi = -INF;
+
+        void merge(const Extents& e)
+        {
+            for (int a = 0; a < 3; ++a) {
+                lo[a] = std::min(lo[a], e.lo[a]);
+                hi[a] = std::max(hi[a], e.hi[a]);
+            }
+            dlo = std::min(dlo, e.dlo);
+            dhi = std::max(dhi, e.dhi);
+        }
+    };
+
+    /// <summary>
+    /// Apply the affine transform m to vcount points in place and return their
+    /// bounds in the same sweep; with dir set, also the range of dot(p, dir).
+    /// One parallel pass instead of one per transform plus one for the bounds.
+    /// </summary>
+    static Extents transformExtents(float* array, size_t vcount, const glm::mat4& m, const glm::vec3* dir = nullptr)
+    {
+        return sweep(array, array, vcount, m, dir);
+    }
+
+    // Same as transformExtents, but the points are left untouched
+    static Extents transformedExtents(const float* array, size_t vcount, const glm::mat4& m, const glm::vec3* dir = nullptr)
+    {
+        return sweep(array, nullptr, vcount, m, dir);
+    }
+
     static void min_max(const float* array, uint32_t vcount,
         float& minx, float& maxx,
         float& miny, float& maxy,
@@ -97,4 +154,54 @@ public:
             minz = std::min(minz, z); maxz = std::max(maxz, z);
         }
     }
+
+private:
+    static constexpr float INF = std::numeric_limits<float>::infinity();
+
+    // m * p for every point of in, written to out when that is set
+    static Extents sweep(const float* in, float* out, size_t vcount, const glm::mat4& m, const glm::vec3* dir)
+    {
+        Extents total;
+        if (!in || vcount == 0) return total;
+
+        // Rows of the upper 3x4 part
+        const float r[3][4] = {
+            { m[0][0], m[1][0], m[2][0], m[3][0] },
+            { m[0][1], m[1][1], m[2][1], m[3][1] },
+            { m[0][2], m[1][2], m[2][2], m[3][2] },
+        };
+        const glm::vec3 d = dir ? *dir : glm::vec3(0.0f);
+
+        const int blocks = std::max(1, std::min(Parallel::threadCount() * 4, static_cast<int>(vcount / 16384) + 1));
+        std::vector<Extents> partial(blocks);
+        Parallel::forRange(0, blocks, [&](int b0, int b1)
+            {
+                for (int b = b0; b < b1; ++b) {
+                    Extents e;
+                    size_t i0 = vcount * b / blocks, i1 = vcount * (b + 1) / blocks;
+                    for (size_t i = i0; i < i1; ++i) {
+                        const float x = in[i * 3 + 0], y = in[i * 3 + 1], z = in[i * 3 + 2];
+                        float p[3];
+                        for (int a = 0; a < 3; ++a) {
+                            p[a] = r[a][0] * x + r[a][1] * y + r[a][2] * z + r[a][3];
+                            e.lo[a] = std::min(e.lo[a], p[a]);
+                            e.hi[a] = std::max(e.hi[a], p[a]);
+                        }
+                        if (out) {
+                            out[i * 3 + 0] = p[0];
+                            out[i * 3 + 1] = p[1];
+                            out[i * 3 + 2] = p[2];
+                        }
+                        if (dir) {
+                            float t = p[0] * d.x + p[1] * d.y + p[2] * d.z;
+                            e.dlo = std::min(e.dlo, t);
+                            e.dhi = std::max(e.dhi, t);
+                        }
+                    }
+                    partial[b] = e;
+                }
+            });
+        for (const auto& e : partial) total.merge(e);
+        return total;
+    }
 };